@@ -36,6 +36,11 @@ THE SOFTWARE.
 
 #include <sys/ioctl.h>
 #include <sys/socket.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#else
+#include <sys/select.h>
+#endif
 #include <netinet/in.h>
 #include <net/if.h>
 #include <arpa/inet.h>
@@ -44,6 +49,10 @@ THE SOFTWARE.
 #include "util.h"
 #include "net.h"
 #include "kernel.h"
+#include "kernel_worker.h"
+#include "hmac_pool.h"
+#include "restart.h"
+#include "trace.h"
 #include "interface.h"
 #include "source.h"
 #include "neighbour.h"
@@ -51,6 +60,7 @@ THE SOFTWARE.
 #include "xroute.h"
 #include "message.h"
 #include "resend.h"
+#include "timer.h"
 #include "configuration.h"
 #include "local.h"
 #include "version.h"
@@ -74,8 +84,10 @@ const char *logfile = NULL,
     *pidfile = "/var/run/babeld.pid",
     *state_file = "/var/lib/babel-state";
 
+/* Room for RECEIVE_BATCH packets of receive_buffer_size bytes each. */
 unsigned char *receive_buffer = NULL;
 int receive_buffer_size = 0;
+struct receive_stats receive_stats;
 
 const unsigned char zeroes[16] = {0};
 const unsigned char ones[16] =
@@ -86,6 +98,7 @@ int protocol_port;
 unsigned char protocol_group[16];
 int protocol_socket = -1;
 int kernel_socket = -1;
+int kernel_link_socket = -1;
 static int kernel_routes_changed = 0;
 static int kernel_link_changed = 0;
 static int kernel_addr_changed = 0;
@@ -94,7 +107,22 @@ struct timeval check_neighbours_timeout, check_interfaces_timeout;
 
 static volatile sig_atomic_t exiting = 0, dumping = 0, reopening = 0;
 
+/* Readiness reported by wait_for_events. */
+#define EVENT_PROTOCOL 1
+#define EVENT_KERNEL 2
+#define EVENT_LOCAL_SERVER 4
+#define EVENT_KERNEL_WORKER 8
+
+static int ready_events = 0;
+static int ready_local[MAX_LOCAL_SOCKETS];
+static int num_ready_local = 0;
+
+static int wait_for_events(struct timeval *tv);
+static void watch_local_socket(int fd);
+static int local_ready(int fd);
+static void dispatch_timer(const struct timer *timer);
 static int accept_local_connections(void);
+static void receive_packets(void);
 static void init_signals(void);
 static void dump_tables(FILE *out);
 
@@ -108,19 +136,31 @@ kernel_route_notify(struct kernel_route *route, void *closure)
 static int
 kernel_addr_notify(struct kernel_addr *addr, void *closure, const unsigned char* tos)
 {
+    struct interface *ifp = find_interface_by_ifindex(addr->ifindex);
+    if(ifp)
+        mark_interface_changed(ifp);
     kernel_addr_changed = 1;
     return -1;
 }
 
+/* Link notifications are only recorded here; the interfaces concerned
+   are checked once per loop iteration by check_changed_interfaces. */
 static int
 kernel_link_notify(struct kernel_link *link, void *closure)
 {
     struct interface *ifp;
-    FOR_ALL_INTERFACES(ifp) {
-        if(strcmp(ifp->name, link->ifname) == 0) {
-            kernel_link_changed = 1;
-            return -1;
-        }
+
+    /* The name and the ifindex may designate different interfaces if
+       one of them has been renamed. */
+    ifp = find_interface(link->ifname);
+    if(ifp) {
+        mark_interface_changed(ifp);
+        kernel_link_changed = 1;
+    }
+    ifp = find_interface_by_ifindex(link->ifindex);
+    if(ifp) {
+        mark_interface_changed(ifp);
+        kernel_link_changed = 1;
     }
     return 0;
 }
@@ -128,9 +168,11 @@ kernel_link_notify(struct kernel_link *link, void *closure)
 int
 main(int argc, char **argv)
 {
-    struct sockaddr_in6 sin6;
     int rc, fd, i, opt;
-    time_t expiry_time, source_expiry_time, kernel_dump_time;
+    time_t expiry_time, source_expiry_time, source_checkpoint_time;
+    time_t channel_check_time;
+    time_t kernel_dump_time;
+    int warm_restart = 0;
     const char **config_files = NULL;
     int num_config_files = 0;
     void *vrc;
@@ -417,6 +459,14 @@ main(int argc, char **argv)
         goto fail_pid;
     }
 
+    rc = kernel_worker_start();
+    if(rc < 0)
+        perror("Warning: couldn't start kernel worker");
+
+    rc = hmac_pool_start();
+    if(rc < 0)
+        perror("Warning: couldn't start MAC verification threads");
+
     rc = finalise_config();
     if(rc < 0) {
         fprintf(stderr, "Couldn't finalise configuration.\n");
@@ -499,6 +549,17 @@ main(int argc, char **argv)
         fd = -1;
     }
 
+    rc = read_restart_state();
+    if(rc < 0)
+        fprintf(stderr, "Warning: couldn't read restart state.\n");
+    warm_restart = rc > 0;
+
+    rc = restore_sources();
+    if(rc < 0)
+        fprintf(stderr, "Warning: couldn't restore sources.\n");
+    else if(rc > 0)
+        debugf("Restored %d sources.\n", rc);
+
     protocol_socket = babel_socket(protocol_port);
     if(protocol_socket < 0) {
         perror("Couldn't create link local socket");
@@ -539,7 +600,9 @@ main(int argc, char **argv)
     schedule_neighbours_check(5000, 1);
     schedule_interfaces_check(30000, 1);
     expiry_time = now.tv_sec + roughly(30);
+    channel_check_time = now.tv_sec + roughly(30);
     source_expiry_time = now.tv_sec + roughly(300);
+    source_checkpoint_time = now.tv_sec + roughly(SOURCE_CHECKPOINT_TIME);
 
     /* Make some noise so that others notice us, and send retractions in
        case we were restarted recently */
@@ -550,7 +613,10 @@ main(int argc, char **argv)
         usleep(roughly(10000));
         gettime(&now);
         send_hello(ifp);
-        send_wildcard_retraction(ifp);
+        /* After a warm restart, the routes we announced are still
+           good, and will be announced again shortly. */
+        if(!warm_restart)
+            send_wildcard_retraction(ifp);
         flushupdates(ifp);
         flushbuf(&ifp->buf, ifp);
     }
@@ -561,7 +627,8 @@ main(int argc, char **argv)
         usleep(roughly(10000));
         gettime(&now);
         send_hello(ifp);
-        send_wildcard_retraction(ifp);
+        if(!warm_restart)
+            send_wildcard_retraction(ifp);
         send_self_update(ifp);
         send_multicast_request(ifp, NULL, 0, NULL, 0, NULL);
         flushupdates(ifp);
@@ -572,56 +639,37 @@ main(int argc, char **argv)
 
     while(1) {
         struct timeval tv;
-        fd_set readfds;
-        struct neighbour *neigh;
+        const struct timeval *next;
+        struct timer timer;
 
         gettime(&now);
 
         tv = check_neighbours_timeout;
         timeval_min(&tv, &check_interfaces_timeout);
         timeval_min_sec(&tv, expiry_time);
+        timeval_min_sec(&tv, channel_check_time);
         timeval_min_sec(&tv, source_expiry_time);
+        if(source_file != NULL)
+            timeval_min_sec(&tv, source_checkpoint_time);
         timeval_min_sec(&tv, kernel_dump_time);
+        if(stale_routes_time != 0)
+            timeval_min_sec(&tv, stale_routes_time);
         timeval_min(&tv, &resend_time);
-        FOR_ALL_INTERFACES(ifp) {
-            if(!if_up(ifp))
-                continue;
-            timeval_min(&tv, &ifp->buf.timeout);
-            timeval_min(&tv, &ifp->hello_timeout);
-            timeval_min(&tv, &ifp->update_timeout);
-            timeval_min(&tv, &ifp->update_flush_timeout);
-        }
-        FOR_ALL_NEIGHBOURS(neigh) {
-            timeval_min(&tv, &neigh->buf.timeout);
-        }
-        FD_ZERO(&readfds);
+        next = next_timer();
+        if(next != NULL)
+            timeval_min(&tv, next);
+        ready_events = 0;
+        num_ready_local = 0;
         if(timeval_compare(&tv, &now) > 0) {
-            int maxfd = 0;
             timeval_minus(&tv, &tv, &now);
-            FD_SET(protocol_socket, &readfds);
-            maxfd = MAX(maxfd, protocol_socket);
-            if(kernel_socket < 0) kernel_setup_socket(1);
-            if(kernel_socket >= 0) {
-                FD_SET(kernel_socket, &readfds);
-                maxfd = MAX(maxfd, kernel_socket);
-            }
-            if(local_server_socket >= 0 &&
-               num_local_sockets < MAX_LOCAL_SOCKETS) {
-                FD_SET(local_server_socket, &readfds);
-                maxfd = MAX(maxfd, local_server_socket);
-            }
-            for(i = 0; i < num_local_sockets; i++) {
-                FD_SET(local_sockets[i].fd, &readfds);
-                maxfd = MAX(maxfd, local_sockets[i].fd);
-            }
-            rc = select(maxfd + 1, &readfds, NULL, NULL, &tv);
+            rc = wait_for_events(&tv);
             if(rc < 0) {
                 if(errno != EINTR) {
-                    perror("select");
+                    perror("wait_for_events");
                     sleep(1);
                 }
-                rc = 0;
-                FD_ZERO(&readfds);
+                ready_events = 0;
+                num_ready_local = 0;
             }
         }
 
@@ -630,45 +678,40 @@ main(int argc, char **argv)
         if(exiting)
             break;
 
-        if(kernel_socket >= 0 && FD_ISSET(kernel_socket, &readfds)) {
+        begin_send_batch();
+
+        if(kernel_socket >= 0 && (ready_events & EVENT_KERNEL)) {
             struct kernel_filter filter = {0};
             filter.route = kernel_route_notify;
             filter.addr = kernel_addr_notify;
             filter.link = kernel_link_notify;
-            kernel_callback(&filter);
-        }
-
-        if(FD_ISSET(protocol_socket, &readfds)) {
-            unsigned char to[16];
-            rc = babel_recv(protocol_socket,
-                            receive_buffer, receive_buffer_size,
-                            (struct sockaddr*)&sin6, sizeof(sin6), to);
-            if(rc < 0) {
-                if(errno != EAGAIN && errno != EINTR) {
-                    perror("recv");
-                    sleep(1);
-                }
-            } else {
-                FOR_ALL_INTERFACES(ifp) {
-                    if(!if_up(ifp))
-                        continue;
-                    if(ifp->ifindex == sin6.sin6_scope_id) {
-                        parse_packet((unsigned char*)&sin6.sin6_addr, ifp,
-                                     receive_buffer, rc, to);
-                        VALGRIND_MAKE_MEM_UNDEFINED(receive_buffer,
-                                                    receive_buffer_size);
-                        break;
-                    }
-                }
+            rc = kernel_callback(&filter);
+            /* We lost kernel notifications, dump the tables concerned
+               again.  A lost address notification may concern any
+               interface. */
+            if(rc & (CHANGE_LINK | CHANGE_ADDR)) {
+                FOR_ALL_INTERFACES(ifp)
+                    mark_interface_changed(ifp);
+                kernel_link_changed = 1;
             }
+            if(rc & CHANGE_ADDR)
+                kernel_addr_changed = 1;
+            if(rc & (CHANGE_ROUTE | CHANGE_RULE))
+                kernel_routes_changed = 1;
         }
 
-        if(local_server_socket >= 0 && FD_ISSET(local_server_socket, &readfds))
+        if(ready_events & EVENT_KERNEL_WORKER)
+            kernel_worker_poll();
+
+        if(ready_events & EVENT_PROTOCOL)
+            receive_packets();
+
+        if(local_server_socket >= 0 && (ready_events & EVENT_LOCAL_SERVER))
            accept_local_connections();
 
         i = 0;
         while(i < num_local_sockets) {
-            if(FD_ISSET(local_sockets[i].fd, &readfds)) {
+            if(local_ready(local_sockets[i].fd)) {
                 rc = local_read(&local_sockets[i]);
                 if(rc <= 0) {
                     if(rc < 0) {
@@ -695,7 +738,7 @@ main(int argc, char **argv)
         }
 
         if(kernel_link_changed || kernel_addr_changed) {
-            check_interfaces();
+            check_changed_interfaces();
             kernel_link_changed = 0;
         }
 
@@ -721,7 +764,19 @@ main(int argc, char **argv)
 
         if(timeval_compare(&check_interfaces_timeout, &now) < 0) {
             check_interfaces();
-            schedule_interfaces_check(30000, 1);
+            /* When the kernel notifies us of link and address changes,
+               the full sweep is only a safety net. */
+            if(kernel_socket >= 0 && kernel_has_link_events())
+                schedule_interfaces_check(300000, 1);
+            else
+                schedule_interfaces_check(30000, 1);
+        }
+
+        /* Channel changes are not link events, so they are polled on
+           their own schedule. */
+        if(now.tv_sec >= channel_check_time) {
+            check_interface_channels();
+            channel_check_time = now.tv_sec + roughly(30);
         }
 
         if(now.tv_sec >= expiry_time) {
@@ -735,40 +790,25 @@ main(int argc, char **argv)
             source_expiry_time = now.tv_sec + roughly(300);
         }
 
-        FOR_ALL_INTERFACES(ifp) {
-            if(!if_up(ifp))
-                continue;
-            if(timeval_compare(&now, &ifp->hello_timeout) >= 0)
-                send_hello(ifp);
-            if(timeval_compare(&now, &ifp->update_timeout) >= 0)
-                send_update(ifp, 0, NULL, 0, NULL, 0, NULL);
-            if(timeval_compare(&now, &ifp->update_flush_timeout) >= 0)
-                flushupdates(ifp);
+        if(now.tv_sec >= source_checkpoint_time) {
+            checkpoint_sources(0);
+            source_checkpoint_time =
+                now.tv_sec + roughly(SOURCE_CHECKPOINT_TIME);
         }
 
+        if(stale_routes_time != 0 && now.tv_sec >= stale_routes_time)
+            flush_stale_routes();
+
         if(resend_time.tv_sec != 0) {
             if(timeval_compare(&now, &resend_time) >= 0)
                 do_resend();
         }
 
-        FOR_ALL_INTERFACES(ifp) {
-            if(!if_up(ifp))
-                continue;
-            if(ifp->buf.timeout.tv_sec != 0) {
-                if(timeval_compare(&now, &ifp->buf.timeout) >= 0) {
-                    flushupdates(ifp);
-                    flushbuf(&ifp->buf, ifp);
-                }
-            }
-        }
+        start_timers();
+        while(pop_timer(&timer))
+            dispatch_timer(&timer);
 
-        FOR_ALL_NEIGHBOURS(neigh) {
-            if(neigh->buf.timeout.tv_sec != 0) {
-                if(timeval_compare(&now, &neigh->buf.timeout) >= 0) {
-                    flushbuf(&neigh->buf, neigh->ifp);
-                }
-            }
-        }
+        end_send_batch();
 
         if(UNLIKELY(debug || dumping)) {
             dump_tables(stdout);
@@ -776,15 +816,38 @@ main(int argc, char **argv)
         }
     }
 
+    end_send_batch();
+
     debugf("Exiting...\n");
     usleep(roughly(10000));
     gettime(&now);
 
+    checkpoint_sources(1);
+
+    /* Leave our routes in the kernel, and don't tell our neighbours
+       that we're going away: we'll be back before they notice. */
+    warm_restart = 0;
+    /* Wait for the queued kernel changes and their failures, so that the
+       saved routes are those in the kernel; later changes are made
+       synchronously. */
+    kernel_worker_stop();
+    if(restart_file != NULL) {
+        rc = write_restart_state();
+        if(rc < 0) {
+            fprintf(stderr, "Couldn't save restart state, flushing routes.\n");
+        } else {
+            forget_installed_routes();
+            warm_restart = 1;
+        }
+    }
+    if(!warm_restart)
+        flush_stale_routes();
+
     /* We need to flush so interface_updown won't try to reinstall. */
     flush_all_routes();
 
     FOR_ALL_INTERFACES(ifp) {
-        if(!if_up(ifp))
+        if(!if_up(ifp) || warm_restart)
             continue;
         send_wildcard_retraction(ifp);
         /* Make sure that we expire quickly from our neighbours'
@@ -797,14 +860,18 @@ main(int argc, char **argv)
     FOR_ALL_INTERFACES(ifp) {
         if(!if_up(ifp))
             continue;
-        /* Make sure they got it. */
-        send_wildcard_retraction(ifp);
-        send_multicast_hello(ifp, 1, 1);
-        flushbuf(&ifp->buf, ifp);
-        usleep(roughly(10000));
-        gettime(&now);
+        if(!warm_restart) {
+            /* Make sure they got it. */
+            send_wildcard_retraction(ifp);
+            send_multicast_hello(ifp, 1, 1);
+            flushbuf(&ifp->buf, ifp);
+            usleep(roughly(10000));
+            gettime(&now);
+        }
         interface_updown(ifp, 0);
     }
+    hmac_pool_stop();
+    kernel_worker_stop();
     kernel_setup_socket(0);
     kernel_setup(0);
 
@@ -856,11 +923,14 @@ main(int argc, char **argv)
     exit(1);
 
  fail:
+    flush_stale_routes();
     FOR_ALL_INTERFACES(ifp) {
         if(!if_up(ifp))
             continue;
         interface_updown(ifp, 0);
     }
+    hmac_pool_stop();
+    kernel_worker_stop();
     kernel_setup_socket(0);
     kernel_setup(0);
  fail_pid:
@@ -916,10 +986,243 @@ accept_local_connections()
         close(s);
         return -1;
     }
+    watch_local_socket(s);
     local_header(ls);
     return 1;
 }
 
+static void
+set_ready(int fd)
+{
+    if(fd == protocol_socket)
+        ready_events |= EVENT_PROTOCOL;
+    else if(fd == kernel_socket || fd == kernel_link_socket)
+        ready_events |= EVENT_KERNEL;
+    else if(fd == local_server_socket)
+        ready_events |= EVENT_LOCAL_SERVER;
+    else if(fd == kernel_worker_fd)
+        ready_events |= EVENT_KERNEL_WORKER;
+    else if(num_ready_local < MAX_LOCAL_SOCKETS)
+        ready_local[num_ready_local++] = fd;
+}
+
+static int
+local_ready(int fd)
+{
+    int i;
+
+    for(i = 0; i < num_ready_local; i++) {
+        if(ready_local[i] == fd)
+            return 1;
+    }
+    return 0;
+}
+
+#ifdef __linux__
+
+/* The protocol and local sockets are registered once; the kernel socket
+   is registered again whenever it has been reopened, and the server
+   socket is only watched while there is room for more clients. */
+
+static int epoll_fd = -1;
+static int epoll_kernel_socket = -1, epoll_kernel_link_socket = -1;
+static int epoll_local_server = 0;
+
+static int
+epoll_watch(int fd, int op)
+{
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    return epoll_ctl(epoll_fd, op, fd, &ev);
+}
+
+static void
+watch_local_socket(int fd)
+{
+    int rc;
+
+    if(epoll_fd < 0)
+        return;
+
+    rc = epoll_watch(fd, EPOLL_CTL_ADD);
+    if(rc < 0)
+        perror("epoll_ctl(local_socket)");
+}
+
+static int
+wait_for_events(struct timeval *tv)
+{
+    struct epoll_event events[8];
+    int i, rc, want, msecs;
+
+    if(epoll_fd < 0) {
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if(epoll_fd < 0)
+            return -1;
+        rc = epoll_watch(protocol_socket, EPOLL_CTL_ADD);
+        if(rc < 0) {
+            close(epoll_fd);
+            epoll_fd = -1;
+            return -1;
+        }
+        if(kernel_worker_fd >= 0) {
+            rc = epoll_watch(kernel_worker_fd, EPOLL_CTL_ADD);
+            if(rc < 0)
+                perror("epoll_ctl(kernel_worker_fd)");
+        }
+        for(i = 0; i < num_local_sockets; i++)
+            watch_local_socket(local_sockets[i].fd);
+    }
+
+    if(kernel_socket < 0) kernel_setup_socket(1);
+    if(kernel_socket >= 0 && kernel_socket != epoll_kernel_socket) {
+        rc = epoll_watch(kernel_socket, EPOLL_CTL_ADD);
+        if(rc >= 0 || errno == EEXIST)
+            epoll_kernel_socket = kernel_socket;
+        else
+            perror("epoll_ctl(kernel_socket)");
+    }
+    if(kernel_link_socket >= 0 &&
+       kernel_link_socket != epoll_kernel_link_socket) {
+        rc = epoll_watch(kernel_link_socket, EPOLL_CTL_ADD);
+        if(rc >= 0 || errno == EEXIST)
+            epoll_kernel_link_socket = kernel_link_socket;
+        else
+            perror("epoll_ctl(kernel_link_socket)");
+    }
+
+    want = local_server_socket >= 0 && num_local_sockets < MAX_LOCAL_SOCKETS;
+    if(want != epoll_local_server) {
+        rc = epoll_watch(local_server_socket,
+                         want ? EPOLL_CTL_ADD : EPOLL_CTL_DEL);
+        if(rc >= 0)
+            epoll_local_server = want;
+        else
+            perror("epoll_ctl(local_server_socket)");
+    }
+
+    if(tv->tv_sec > 1000000)
+        msecs = 1000000000;
+    else
+        msecs = tv->tv_sec * 1000 + (tv->tv_usec + 999) / 1000;
+
+    rc = epoll_wait(epoll_fd, events, 8, msecs);
+    if(rc < 0)
+        return -1;
+
+    for(i = 0; i < rc; i++) {
+        /* kernel_callback may close and reopen the kernel sockets under
+           the same number, which silently drops them from the set. */
+        if(events[i].data.fd == kernel_socket ||
+           events[i].data.fd == kernel_link_socket) {
+            epoll_kernel_socket = -1;
+            epoll_kernel_link_socket = -1;
+        }
+        set_ready(events[i].data.fd);
+    }
+    return rc;
+}
+
+#else
+
+static void
+watch_local_socket(int fd)
+{
+}
+
+static int
+wait_for_events(struct timeval *tv)
+{
+    fd_set readfds;
+    int i, rc, maxfd = 0;
+
+    FD_ZERO(&readfds);
+    FD_SET(protocol_socket, &readfds);
+    maxfd = MAX(maxfd, protocol_socket);
+    if(kernel_socket < 0) kernel_setup_socket(1);
+    if(kernel_socket >= 0) {
+        FD_SET(kernel_socket, &readfds);
+        maxfd = MAX(maxfd, kernel_socket);
+    }
+    if(kernel_link_socket >= 0) {
+        FD_SET(kernel_link_socket, &readfds);
+        maxfd = MAX(maxfd, kernel_link_socket);
+    }
+    if(local_server_socket >= 0 &&
+       num_local_sockets < MAX_LOCAL_SOCKETS) {
+        FD_SET(local_server_socket, &readfds);
+        maxfd = MAX(maxfd, local_server_socket);
+    }
+    if(kernel_worker_fd >= 0) {
+        FD_SET(kernel_worker_fd, &readfds);
+        maxfd = MAX(maxfd, kernel_worker_fd);
+    }
+    for(i = 0; i < num_local_sockets; i++) {
+        FD_SET(local_sockets[i].fd, &readfds);
+        maxfd = MAX(maxfd, local_sockets[i].fd);
+    }
+    rc = select(maxfd + 1, &readfds, NULL, NULL, tv);
+    if(rc < 0)
+        return -1;
+
+    for(i = 0; i <= maxfd; i++) {
+        if(FD_ISSET(i, &readfds))
+            set_ready(i);
+    }
+    return rc;
+}
+
+#endif
+
+static void
+dispatch_timer(const struct timer *timer)
+{
+    struct interface *ifp;
+    struct neighbour *neigh;
+
+    if(timer->type == TIMER_NEIGHBOUR_BUF) {
+        neigh = timer->owner;
+        if(neigh->buf.timeout.tv_sec != 0)
+            flushbuf(&neigh->buf, neigh->ifp);
+        return;
+    }
+
+    ifp = timer->owner;
+    if(!if_up(ifp))
+        return;
+
+    switch(timer->type) {
+    case TIMER_HELLO:
+        send_hello(ifp);
+        break;
+    case TIMER_UPDATE:
+        send_periodic_update(ifp);
+        break;
+    case TIMER_UPDATE_SLICE:
+        if(ifp->update_slice_timeout.tv_sec != 0)
+            send_update_slice(ifp);
+        break;
+    case TIMER_UPDATE_FLUSH:
+        flushupdates(ifp);
+        break;
+    case TIMER_PACING:
+        if(ifp->pacing.timeout.tv_sec != 0)
+            send_paced_packets(ifp);
+        break;
+    case TIMER_INTERFACE_BUF:
+        if(ifp->buf.timeout.tv_sec != 0) {
+            flushupdates(ifp);
+            flushbuf(&ifp->buf, ifp);
+        }
+        break;
+    default:
+        fprintf(stderr, "Unknown timer type %d.\n", timer->type);
+    }
+}
+
 void
 schedule_neighbours_check(int msecs, int override)
 {
@@ -944,6 +1247,76 @@ schedule_interfaces_check(int msecs, int override)
         timeval_min(&check_interfaces_timeout, &timeout);
 }
 
+/* Read and parse all the packets pending on the protocol socket, up to
+   RECEIVE_MAX packets so that timers don't starve. */
+static void
+receive_packets(void)
+{
+    struct sockaddr_in6 sin6[RECEIVE_BATCH];
+    unsigned char to[RECEIVE_BATCH][16];
+    int len[RECEIVE_BATCH];
+    struct hmac_job jobs[RECEIVE_BATCH];
+    unsigned int drops = receive_stats.drops;
+    struct interface *ifp;
+    int i, n, total = 0;
+
+    while(total < RECEIVE_MAX) {
+        n = babel_recv_batch(protocol_socket,
+                             receive_buffer, receive_buffer_size,
+                             sin6, to, len, &drops, RECEIVE_BATCH);
+        if(n < 0) {
+            if(errno != EAGAIN && errno != EINTR) {
+                perror("recv");
+                sleep(1);
+            }
+            break;
+        }
+
+        trace_receive_time = trace_now();
+        receive_stats.batches++;
+        receive_stats.packets += n;
+        if(n > receive_stats.max_batch)
+            receive_stats.max_batch = n;
+
+        for(i = 0; i < n; i++) {
+            ifp = NULL;
+            if(len[i] >= 0) {
+                ifp = find_interface_by_ifindex(sin6[i].sin6_scope_id);
+                if(ifp && !if_up(ifp))
+                    ifp = NULL;
+            }
+            jobs[i].from = (unsigned char*)&sin6[i].sin6_addr;
+            jobs[i].to = to[i];
+            jobs[i].packet = receive_buffer + i * receive_buffer_size;
+            jobs[i].packetlen = len[i];
+            jobs[i].ifp = ifp;
+            jobs[i].rc = HMAC_UNCHECKED;
+        }
+
+        /* MACs are checked in parallel if we have threads for that, the
+           rest of the parsing is done here, in order. */
+        hmac_pool_verify(jobs, n);
+
+        for(i = 0; i < n; i++) {
+            if(jobs[i].ifp != NULL)
+                parse_packet(jobs[i].from, jobs[i].ifp,
+                             jobs[i].packet, jobs[i].packetlen, jobs[i].to,
+                             jobs[i].rc);
+        }
+        VALGRIND_MAKE_MEM_UNDEFINED(receive_buffer,
+                                    RECEIVE_BATCH * receive_buffer_size);
+
+        total += n;
+        if(n < RECEIVE_BATCH)
+            break;
+    }
+
+    if(drops != receive_stats.drops) {
+        debugf("Kernel dropped %u packets.\n", drops - receive_stats.drops);
+        receive_stats.drops = drops;
+    }
+}
+
 int
 resize_receive_buffer(int size)
 {
@@ -952,7 +1325,7 @@ resize_receive_buffer(int size)
     if(size <= receive_buffer_size)
         return 0;
 
-    new = realloc(receive_buffer, size);
+    new = realloc(receive_buffer, RECEIVE_BATCH * size);
     if(new == NULL) {
         perror("realloc(receive_buffer)");
         return -1;
@@ -1085,6 +1458,7 @@ dump_xroute(FILE *out, struct xroute *xroute)
 static void
 dump_tables(FILE *out)
 {
+    struct interface *ifp;
     struct neighbour *neigh;
     struct xroute_stream *xroutes;
     struct route_stream *routes;
@@ -1093,6 +1467,24 @@ dump_tables(FILE *out)
 
     fprintf(out, "My id %s seqno %d\n", format_eui64(myid), myseqno);
 
+    fprintf(out, "Received %lu packets in %lu batches (max %d), "
+            "%u dropped by the kernel.\n",
+            receive_stats.packets, receive_stats.batches,
+            receive_stats.max_batch, receive_stats.drops);
+
+    FOR_ALL_INTERFACES(ifp) {
+        if(ifp->pacing.rate == 0 && ifp->pacing.packet_rate == 0)
+            continue;
+        fprintf(out, "Interface %s rate %u bytes/s %u packets/s "
+                "queued %d deferred %lu (avg %lu ms, max %u ms) "
+                "overflows %lu\n",
+                ifp->name, ifp->pacing.rate, ifp->pacing.packet_rate,
+                ifp->pacing.len, ifp->pacing.deferred,
+                ifp->pacing.deferred > 0 ?
+                ifp->pacing.deferral_msecs / ifp->pacing.deferred : 0,
+                ifp->pacing.max_deferral_msecs, ifp->pacing.overflows);
+    }
+
     FOR_ALL_NEIGHBOURS(neigh) {
         fprintf(out, "Neighbour %s dev %s reach %04x ureach %04x "
                 "rxcost %u txcost %d rtt %s rttcost %u chan %d%s.\n",
@@ -28,6 +28,7 @@ THE SOFTWARE.
 #endif
 
 #define RTPROT_BABEL_LOCAL -2
+#define RTPROT_BABEL_AGGREGATE -3
 
 #undef MAX
 #undef MIN
@@ -105,6 +106,8 @@ extern int local_server_write;
 extern unsigned char protocol_group[16];
 extern int protocol_socket;
 extern int kernel_socket;
+/* Link and address notifications, -1 if they come on kernel_socket. */
+extern int kernel_link_socket;
 extern int max_request_hopcount;
 
 void schedule_neighbours_check(int msecs, int override);
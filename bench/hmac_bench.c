@@ -0,0 +1,158 @@
+/*
+Copyright (c) 2007, 2008 by Juliusz Chroboczek
+Copyright (c) 2021 by Florian Wiedner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* Measures how many MACs per second add_hmac computes for typical packet
+   sizes, with the reference implementations and with each hardware
+   backend that this CPU supports, which are selected with
+   hmac_accel_enable. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+
+#include "../babeld.h"
+#include "../util.h"
+#include "../interface.h"
+#include "../configuration.h"
+#include "../hmac.h"
+#include "../hmac_accel.h"
+
+#define BENCH_TIME 0.5
+
+static const int sizes[] = {64, 256, 512, 1024, 1400};
+
+static double
+elapsed(const struct timespec *start)
+{
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) +
+        (end.tv_nsec - start->tv_nsec) / 1.0E9;
+}
+
+static void
+bench(const char *name, struct interface *ifp, struct buffered *buf)
+{
+    unsigned char header[4] = {42, 2, 0, 0};
+    struct timespec start;
+    double t;
+    long count;
+    int i, j;
+
+    printf("%-24s", name);
+    for(i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        buf->len = sizes[i];
+        DO_HTONS(header + 2, buf->len);
+        count = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        do {
+            for(j = 0; j < 256; j++) {
+                if(add_hmac(buf, ifp, header) < 0) {
+                    fprintf(stderr, "Couldn't compute MAC.\n");
+                    exit(1);
+                }
+            }
+            count += 256;
+            t = elapsed(&start);
+        } while(t < BENCH_TIME);
+        printf(" %10.0f", count / t);
+    }
+    printf("\n");
+}
+
+int
+main(int argc, char **argv)
+{
+    static unsigned char sha256_key[64], blake2s_key[32], ll[16];
+    int accel_sha256, accel_blake2s;
+    struct interface ifp;
+    struct buffered buf;
+    struct key *sha256, *blake2s;
+    int i;
+
+    hmac_accel_enable(1, 1);
+    accel_sha256 = sha256_accel_available();
+    accel_blake2s = blake2s_accel_available();
+
+    for(i = 0; i < 64; i++)
+        sha256_key[i] = i;
+    for(i = 0; i < 32; i++)
+        blake2s_key[i] = 0xFF - i;
+    ll[0] = 0xFE;
+    ll[1] = 0x80;
+    ll[15] = 1;
+
+    /* Both keyed states are computed while the backends are enabled. */
+    sha256 = add_key("sha256", AUTH_TYPE_SHA256, 64, sha256_key);
+    blake2s = add_key("blake2s", AUTH_TYPE_BLAKE2S128, 32, blake2s_key);
+    if(sha256 == NULL || blake2s == NULL) {
+        fprintf(stderr, "Couldn't add keys.\n");
+        return 1;
+    }
+
+    memset(&ifp, 0, sizeof(ifp));
+    ifp.ll = &ll;
+    ifp.numll = 1;
+    memset(&buf, 0, sizeof(buf));
+    buf.size = 1500;
+    buf.buf = calloc(1, buf.size);
+    if(buf.buf == NULL) {
+        perror("calloc");
+        return 1;
+    }
+    memcpy(buf.sin6.sin6_addr.s6_addr, ll, 16);
+    buf.sin6.sin6_addr.s6_addr[15] = 2;
+
+    printf("%-24s", "MACs per second");
+    for(i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+        printf(" %5d bytes", sizes[i]);
+    printf("\n");
+
+    hmac_accel_enable(0, 0);
+    ifp.key = sha256;
+    bench("SHA-256 reference", &ifp, &buf);
+    ifp.key = blake2s;
+    bench("BLAKE2s reference", &ifp, &buf);
+
+    if(accel_sha256) {
+        hmac_accel_enable(1, 0);
+        ifp.key = sha256;
+#if defined(__x86_64__) || defined(__i386__)
+        bench("SHA-256 SHA-NI", &ifp, &buf);
+#else
+        bench("SHA-256 ARMv8", &ifp, &buf);
+#endif
+    }
+    if(accel_blake2s) {
+        hmac_accel_enable(0, 1);
+        ifp.key = blake2s;
+        bench("BLAKE2s SSE4.1", &ifp, &buf);
+    }
+
+    free(buf.buf);
+    return 0;
+}
@@ -0,0 +1,130 @@
+/*
+Copyright (c) 2007, 2008 by Juliusz Chroboczek
+Copyright (c) 2021 by Florian Wiedner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* Measures the cost of the per-packet interface lookup and of the
+   per-iteration check of changed interfaces as the number of interfaces
+   grows, against a walk of the interface list.  The interfaces are fake
+   and never marked as changed, so nothing here talks to the kernel. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+
+#include "../babeld.h"
+#include "../util.h"
+#include "../kernel.h"
+#include "../interface.h"
+
+#define LOOKUPS 1000000
+
+/* Spread the lookups over all the interfaces. */
+#define PICK(i, count) ((unsigned int)(i) * 2654435761U % (count) + 1)
+
+static double
+elapsed(const struct timespec *start)
+{
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) +
+        (end.tv_nsec - start->tv_nsec) / 1.0E9;
+}
+
+static struct interface *
+walk_interfaces(unsigned int ifindex)
+{
+    struct interface *ifp;
+    FOR_ALL_INTERFACES(ifp) {
+        if(ifp->ifindex == ifindex)
+            return ifp;
+    }
+    return NULL;
+}
+
+static int num_interfaces = 0;
+
+static void
+add_interfaces(int count)
+{
+    char name[32];
+    struct interface *ifp;
+    int i;
+
+    for(i = num_interfaces; i < count; i++) {
+        snprintf(name, sizeof(name), "bench%d", i);
+        ifp = add_interface(name, NULL);
+        if(ifp == NULL) {
+            fprintf(stderr, "Couldn't add interface %s.\n", name);
+            exit(1);
+        }
+        set_interface_ifindex(ifp, i + 1);
+    }
+    num_interfaces = count;
+}
+
+static void
+bench(int count)
+{
+    struct timespec start;
+    unsigned int found = 0;
+    double hash, walk, tick;
+    int i, ticks;
+
+    add_interfaces(count);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(i = 0; i < LOOKUPS; i++)
+        found += find_interface_by_ifindex(PICK(i, count)) != NULL;
+    hash = elapsed(&start);
+
+    ticks = MAX(LOOKUPS / count, 1);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(i = 0; i < ticks; i++)
+        found += walk_interfaces(PICK(i, count)) != NULL;
+    walk = elapsed(&start) * LOOKUPS / ticks;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(i = 0; i < ticks; i++)
+        check_changed_interfaces();
+    tick = elapsed(&start) / ticks;
+
+    if(found != LOOKUPS + ticks)
+        fprintf(stderr, "Lookup failed.\n");
+
+    printf("%6d interfaces: lookup %7.1f ns (list walk %9.1f ns), "
+           "changed-interface check %9.1f ns per iteration\n",
+           count, hash * 1.0E9 / LOOKUPS, walk * 1.0E9 / LOOKUPS,
+           tick * 1.0E9);
+}
+
+int
+main(int argc, char **argv)
+{
+    int count;
+
+    gettime(&now);
+    for(count = 16; count <= 16384; count *= 4)
+        bench(count);
+    return 0;
+}
@@ -38,9 +38,15 @@ THE SOFTWARE.
 #include "babeld.h"
 #include "util.h"
 #include "interface.h"
+#include "source.h"
+#include "neighbour.h"
 #include "route.h"
 #include "kernel.h"
+#include "xroute.h"
 #include "hmac.h"
+#include "hmac_pool.h"
+#include "restart.h"
+#include "lookup.h"
 #include "configuration.h"
 
 static struct filter *input_filters = NULL;
@@ -376,6 +382,7 @@ free_filter(struct filter *f)
     free(f->neigh);
     free(f->action.src_prefix);
     free(f->action.tos);
+    free(f->action.aggregate);
     free(f);
 }
 
@@ -543,6 +550,18 @@ parse_filter(int c, gnc_t gnc, void *closure, struct filter **filter_return)
             if(len != 1){
                 goto error;
             }
+        } else if(strcmp(token, "aggregate") == 0) {
+            int af;
+            c = getnet(c, &filter->action.aggregate,
+                       &filter->action.aggregate_plen, &af, gnc, closure);
+            if(c < -1)
+                goto error;
+            if(filter->af == AF_UNSPEC)
+                filter->af = af;
+            else if(filter->af != af)
+                goto error;
+        } else if(strcmp(token, "summary-only") == 0) {
+            filter->action.summary_only = 1;
         } else {
             goto error;
         }
@@ -710,6 +729,18 @@ parse_anonymous_ifconf(int c, gnc_t gnc, void *closure,
             if(c < -1 || penalty <= 0 || penalty > 0xFFFF)
                 goto error;
             if_conf->max_rtt_penalty = penalty;
+        } else if(strcmp(token, "rate-limit") == 0) {
+            int rate;
+            c = getint(c, &rate, gnc, closure);
+            if(c < -1 || rate <= 0)
+                goto error;
+            if_conf->rate_limit = rate;
+        } else if(strcmp(token, "packet-rate-limit") == 0) {
+            int rate;
+            c = getint(c, &rate, gnc, closure);
+            if(c < -1 || rate <= 0)
+                goto error;
+            if_conf->packet_rate_limit = rate;
         } else if(strcmp(token, "key") == 0) {
             char *key_id;
             struct key *key;
@@ -929,6 +960,8 @@ merge_ifconf(struct interface_conf *dest,
     MERGE(rtt_min);
     MERGE(rtt_max);
     MERGE(max_rtt_penalty);
+    MERGE(rate_limit);
+    MERGE(packet_rate_limit);
     MERGE(key);
 
 #undef MERGE
@@ -1072,7 +1105,9 @@ parse_option(int c, gnc_t gnc, void *closure, char *token)
               strcmp(token, "log-file") == 0 ||
               strcmp(token, "pid-file") == 0 ||
               strcmp(token, "local-path") == 0 ||
-              strcmp(token, "local-path-readwrite") == 0) {
+              strcmp(token, "local-path-readwrite") == 0 ||
+              strcmp(token, "warm-restart-file") == 0 ||
+              strcmp(token, "source-file") == 0) {
         char *file;
         c = getstring(c, &file, gnc, closure);
         if(c < -1)
@@ -1095,8 +1130,32 @@ parse_option(int c, gnc_t gnc, void *closure, char *token)
             free(local_server_path);
             local_server_path = file;
             local_server_write = 1;
+        } else if(strcmp(token, "warm-restart-file") == 0) {
+            free(restart_file);
+            restart_file = file;
+        } else if(strcmp(token, "source-file") == 0) {
+            free(source_file);
+            source_file = file;
         } else
             abort();
+    } else if(strcmp(token, "warm-restart-hold-time") == 0) {
+        int v;
+        c = getint(c, &v, gnc, closure);
+        if(c < -1 || v < 0)
+            goto error;
+        restart_hold_time = v;
+    } else if(strcmp(token, "kernel-buffer-size") == 0) {
+        int v;
+        c = getint(c, &v, gnc, closure);
+        if(c < -1 || v < 4096)
+            goto error;
+        kernel_socket_buffer_size = v;
+    } else if(strcmp(token, "mac-verify-threads") == 0) {
+        int v;
+        c = getint(c, &v, gnc, closure);
+        if(c < -1 || v < 0 || v > 16)
+            goto error;
+        hmac_pool_threads = v;
     } else if(strcmp(token, "debug") == 0) {
         int d;
         c = getint(c, &d, gnc, closure);
@@ -1148,6 +1207,101 @@ parse_option(int c, gnc_t gnc, void *closure, char *token)
 
 }
 
+/* Parse the arguments of a lookup request, and format the result. */
+static int
+parse_lookup(int c, gnc_t gnc, void *closure,
+             int *action_return, const char **message_return)
+{
+    static char buf[300];
+    char *token = NULL;
+    unsigned char *address = NULL, *src_address = NULL, *tos = NULL;
+    struct lookup_entry *entry;
+    struct babel_route *route = NULL;
+    struct xroute *xroute = NULL;
+    int af, src_af, rc;
+
+    c = getip(c, &address, &af, gnc, closure);
+    if(c < -1)
+        goto fail;
+
+    while(1) {
+        c = skip_whitespace(c, gnc, closure);
+        if(c < 0 || c == '\n' || c == '#') {
+            c = skip_to_eol(c, gnc, closure);
+            break;
+        }
+        c = getword(c, &token, gnc, closure);
+        if(c < -1)
+            goto fail;
+        if(strcmp(token, "from") == 0) {
+            c = getip(c, &src_address, &src_af, gnc, closure);
+            if(c < -1 || src_af != af)
+                goto fail;
+        } else if(strcmp(token, "tos") == 0) {
+            int len;
+            c = gethex(c, &tos, &len, gnc, closure);
+            if(c < -1 || len != 1)
+                goto fail;
+        } else {
+            goto fail;
+        }
+        free(token);
+        token = NULL;
+    }
+
+    entry = lookup_address(address, src_address, tos);
+    if(entry && entry->route)
+        route = entry->route;
+    else if(entry)
+        xroute = find_xroute(entry->prefix, entry->plen,
+                             entry->src_prefix, entry->src_plen, entry->tos);
+
+    if(xroute) {
+        rc = snprintf(buf, sizeof(buf),
+                      "xroute prefix %s from %s tos %s metric %d",
+                      format_prefix(xroute->prefix, xroute->plen),
+                      format_prefix(xroute->src_prefix, xroute->src_plen),
+                      format_tos_value(xroute->tos),
+                      xroute->metric);
+        if(rc < 0 || rc >= sizeof(buf))
+            goto fail;
+        *action_return = CONFIG_ACTION_LOOKUP;
+        *message_return = buf;
+    } else if(route == NULL) {
+        *action_return = CONFIG_ACTION_NO;
+        *message_return = "No route";
+    } else {
+        rc = snprintf(buf, sizeof(buf),
+                      "route %lx prefix %s from %s tos %s "
+                      "id %s metric %d via %s if %s",
+                      (unsigned long)route,
+                      format_prefix(route->src->prefix, route->src->plen),
+                      format_prefix(route->src->src_prefix,
+                                    route->src->src_plen),
+                      format_tos_value(route->src->tos),
+                      format_eui64(route->src->id),
+                      route_metric(route),
+                      format_address(route->nexthop),
+                      route->neigh->ifp->name);
+        if(rc < 0 || rc >= sizeof(buf))
+            goto fail;
+        *action_return = CONFIG_ACTION_LOOKUP;
+        *message_return = buf;
+    }
+
+    free(address);
+    free(src_address);
+    free(tos);
+    return c;
+
+ fail:
+    free(token);
+    free(address);
+    free(src_address);
+    free(tos);
+    return -2;
+}
+
 static int
 parse_config_line(int c, gnc_t gnc, void *closure,
                   int *action_return, const char **message_return)
@@ -1189,6 +1343,17 @@ parse_config_line(int c, gnc_t gnc, void *closure,
         if(c < -1 || !action_return)
             goto fail;
         *action_return = CONFIG_ACTION_UNMONITOR;
+    } else if(strcmp(token, "stats") == 0) {
+        c = skip_eol(c, gnc, closure);
+        if(c < -1 || !action_return)
+            goto fail;
+        *action_return = CONFIG_ACTION_STATS;
+    } else if(strcmp(token, "lookup") == 0) {
+        if(!action_return || !message_return)
+            goto fail;
+        c = parse_lookup(c, gnc, closure, action_return, message_return);
+        if(c < -1)
+            goto fail;
     } else if(config_finalised && !local_server_write) {
         /* The remaining directives are only allowed in read-write mode. */
         c = skip_to_eol(c, gnc, closure);
@@ -1390,9 +1555,17 @@ parse_config_from_string(char *string, int n, const char **message_return)
 static void
 renumber_filter(struct filter *filter)
 {
+    struct interface *ifp;
+
     while(filter) {
-        if(filter->ifname)
-            filter->ifindex = if_nametoindex(filter->ifname);
+        if(filter->ifname) {
+            /* Our own interfaces have just been checked. */
+            ifp = find_interface(filter->ifname);
+            if(ifp)
+                filter->ifindex = ifp->ifindex;
+            else
+                filter->ifindex = if_nametoindex(filter->ifname);
+        }
         filter = filter->next;
     }
 }
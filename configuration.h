@@ -29,6 +29,8 @@ THE SOFTWARE.
 #define CONFIG_ACTION_MONITOR 3
 #define CONFIG_ACTION_UNMONITOR 4
 #define CONFIG_ACTION_NO 5
+#define CONFIG_ACTION_LOOKUP 6
+#define CONFIG_ACTION_STATS 7
 
 #define AUTH_TYPE_NONE 0
 #define AUTH_TYPE_SHA256 1
@@ -67,6 +69,9 @@ struct filter_result {
     unsigned char *tos;
     unsigned int table;
     unsigned char *pref_src;
+    unsigned char *aggregate;
+    unsigned char aggregate_plen;
+    unsigned char summary_only;
 };
 
 struct filter {
@@ -23,6 +23,7 @@ THE SOFTWARE.
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <assert.h>
 #include <sys/time.h>
 #include <netinet/in.h>
@@ -35,12 +36,85 @@ THE SOFTWARE.
 #include "neighbour.h"
 #include "util.h"
 #include "hmac.h"
+#include "hmac_accel.h"
 #include "configuration.h"
 #include "message.h"
 
 struct key **keys = NULL;
 int numkeys = 0, maxkeys = 0;
 
+/* The part of the MAC computation that only depends on the key is done
+   once, in add_key: the SHA-256 contexts after the ipad and opad blocks,
+   and the BLAKE2s state after the key block.  Each MAC then only hashes
+   the packet. */
+struct key_state {
+    SHA256Context inner, outer;
+    blake2s_state blake2s;
+    /* Used instead of the above when hmac_accel_init found support. */
+    struct sha256_accel inner_accel, outer_accel;
+    struct blake2s_accel blake2s_accel;
+};
+
+static int
+compute_key_state(struct key *key)
+{
+    int rc;
+
+    hmac_accel_init();
+
+    if(key->state == NULL) {
+        key->state = calloc(1, sizeof(struct key_state));
+        if(key->state == NULL)
+            return -1;
+    }
+
+    switch(key->type) {
+    case AUTH_TYPE_SHA256: {
+        unsigned char ipad[64], opad[64];
+        if(key->len != 64)
+            return -1;
+        for(int i = 0; i < 64; i++) {
+            ipad[i] = key->value[i] ^ 0x36;
+            opad[i] = key->value[i] ^ 0x5c;
+        }
+        rc = SHA256Reset(&key->state->inner);
+        if(rc != 0)
+            return -1;
+        rc = SHA256Input(&key->state->inner, ipad, 64);
+        if(rc != 0)
+            return -1;
+        rc = SHA256Reset(&key->state->outer);
+        if(rc != 0)
+            return -1;
+        rc = SHA256Input(&key->state->outer, opad, 64);
+        if(rc != 0)
+            return -1;
+        if(sha256_accel_available()) {
+            sha256_accel_init(&key->state->inner_accel);
+            sha256_accel_update(&key->state->inner_accel, ipad, 64);
+            sha256_accel_init(&key->state->outer_accel);
+            sha256_accel_update(&key->state->outer_accel, opad, 64);
+        }
+        return 1;
+    }
+    case AUTH_TYPE_BLAKE2S128:
+        if(key->len > 32)
+            return -1;
+        rc = blake2s_init_key(&key->state->blake2s, 16, key->value, key->len);
+        if(rc < 0)
+            return -1;
+        if(blake2s_accel_available()) {
+            rc = blake2s_accel_init_key(&key->state->blake2s_accel, 16,
+                                        key->value, key->len);
+            if(rc < 0)
+                return -1;
+        }
+        return 1;
+    default:
+        return -1;
+    }
+}
+
 struct key *
 find_key(const char *id)
 {
@@ -79,6 +153,8 @@ add_key(char *id, int type, int len, unsigned char *value)
         key->type = type;
         key->len = len;
         key->value = value;
+        if(compute_key_state(key) < 0)
+            fprintf(stderr, "Couldn't set up key %s.\n", id);
         return key;
     }
 
@@ -101,11 +177,58 @@ add_key(char *id, int type, int len, unsigned char *value)
     key->type = type;
     key->len = len;
     key->value = value;
+    if(compute_key_state(key) < 0)
+        fprintf(stderr, "Couldn't set up key %s.\n", id);
 
     keys[numkeys++] = key;
     return key;
 }
 
+static int
+compute_hmac_sha256_accel(const unsigned char *src, const unsigned char *dst,
+                          const unsigned char *port,
+                          const unsigned char *packet_header,
+                          const unsigned char *body, int bodylen,
+                          struct key *key, unsigned char *hmac_return)
+{
+    struct sha256_accel inner, outer;
+    unsigned char ihash[32];
+
+    inner = key->state->inner_accel;
+    sha256_accel_update(&inner, src, 16);
+    sha256_accel_update(&inner, port, 2);
+    sha256_accel_update(&inner, dst, 16);
+    sha256_accel_update(&inner, port, 2);
+    sha256_accel_update(&inner, packet_header, 4);
+    sha256_accel_update(&inner, body, bodylen);
+    sha256_accel_final(&inner, ihash);
+
+    outer = key->state->outer_accel;
+    sha256_accel_update(&outer, ihash, 32);
+    sha256_accel_final(&outer, hmac_return);
+    return 32;
+}
+
+static int
+compute_hmac_blake2s_accel(const unsigned char *src, const unsigned char *dst,
+                           const unsigned char *port,
+                           const unsigned char *packet_header,
+                           const unsigned char *body, int bodylen,
+                           struct key *key, unsigned char *hmac_return)
+{
+    struct blake2s_accel s;
+
+    s = key->state->blake2s_accel;
+    blake2s_accel_update(&s, src, 16);
+    blake2s_accel_update(&s, port, 2);
+    blake2s_accel_update(&s, dst, 16);
+    blake2s_accel_update(&s, port, 2);
+    blake2s_accel_update(&s, packet_header, 4);
+    blake2s_accel_update(&s, body, bodylen);
+    blake2s_accel_final(&s, hmac_return);
+    return 16;
+}
+
 static int
 compute_hmac(const unsigned char *src, const unsigned char *dst,
              const unsigned char *packet_header,
@@ -115,21 +238,20 @@ compute_hmac(const unsigned char *src, const unsigned char *dst,
     unsigned char port[2];
     int rc;
 
+    if(key->state == NULL)
+        return -1;
+
     DO_HTONS(port, (unsigned short)protocol_port);
     switch(key->type) {
     case AUTH_TYPE_SHA256: {
         SHA256Context inner, outer;
-        unsigned char ipad[64], ihash[32], opad[64];
+        unsigned char ihash[32];
         if(key->len != 64)
             return -1;
-        for(int i = 0; i < 64; i++)
-            ipad[i] = key->value[i] ^ 0x36;
-        rc = SHA256Reset(&inner);
-        if(rc < 0)
-            return -1;
-        rc = SHA256Input(&inner, ipad, 64);
-        if(rc < 0)
-            return -1;
+        if(sha256_accel_available())
+            return compute_hmac_sha256_accel(src, dst, port, packet_header,
+                                             body, bodylen, key, hmac_return);
+        inner = key->state->inner;
 
         rc = SHA256Input(&inner, src, 16);
         if(rc != 0)
@@ -154,15 +276,7 @@ compute_hmac(const unsigned char *src, const unsigned char *dst,
         if(rc != 0)
             return -1;
 
-        for(int i = 0; i < 64; i++)
-            opad[i] = key->value[i] ^ 0x5c;
-
-        rc = SHA256Reset(&outer);
-        if(rc != 0)
-            return -1;
-        rc = SHA256Input(&outer, opad, 64);
-        if(rc != 0)
-            return -1;
+        outer = key->state->outer;
         rc = SHA256Input(&outer, ihash, 32);
         if(rc != 0)
             return -1;
@@ -175,9 +289,11 @@ compute_hmac(const unsigned char *src, const unsigned char *dst,
         blake2s_state s;
         if(key->len > 32)
             return -1;
-        rc = blake2s_init_key(&s, 16, key->value, key->len);
-        if(rc < 0)
-            return -1;
+        if(blake2s_accel_available())
+            return compute_hmac_blake2s_accel(src, dst, port, packet_header,
+                                              body, bodylen, key,
+                                              hmac_return);
+        s = key->state->blake2s;
         rc = blake2s_update(&s, src, 16);
         if(rc < 0)
             return -1;
@@ -239,30 +355,21 @@ add_hmac(struct buffered *buf, struct interface *ifp,
 }
 
 
-static int
-compare_hmac(const unsigned char *src, const unsigned char *dst,
-             const unsigned char *packet, int bodylen,
-             const unsigned char *hmac, int hmaclen,
-             struct key *key)
-{
-    unsigned char buf[MAX_DIGEST_LEN];
-    int len;
-
-    len = compute_hmac(src, dst, packet, packet + 4, bodylen, key, buf);
-    return len == hmaclen && (memcmp(buf, hmac, hmaclen) == 0);
-}
-
+/* All the MAC TLVs of a packet cover the same data, and we only have
+   one key per interface, so the MAC is computed at most once per packet
+   and compared with each TLV in turn.  This doesn't touch any global
+   state, and may be called from the threads of the MAC pool. */
 int
-check_hmac(const unsigned char *packet, int packetlen, int bodylen,
-           const unsigned char *src, const unsigned char *dst,
-           struct interface *ifp)
+verify_hmac(const unsigned char *packet, int packetlen, int bodylen,
+            const unsigned char *src, const unsigned char *dst,
+            struct interface *ifp)
 {
+    unsigned char hmac[MAX_DIGEST_LEN];
     int i = bodylen + 4;
     int len;
+    int hmaclen = -2;           /* not computed yet */
     int rc = -1;
 
-    debugf("check_hmac %s -> %s\n",
-           format_address(src), format_address(dst));
     while(i < packetlen) {
         if(i + 2 > packetlen) {
             fprintf(stderr, "Received truncated message.\n");
@@ -275,8 +382,10 @@ check_hmac(const unsigned char *packet, int packetlen, int bodylen,
                 fprintf(stderr, "Received truncated message.\n");
                 return -1;
             }
-            ok = compare_hmac(src, dst, packet, bodylen,
-                              packet + i + 2, len, ifp->key);
+            if(hmaclen == -2)
+                hmaclen = compute_hmac(src, dst, packet, packet + 4, bodylen,
+                                       ifp->key, hmac);
+            ok = hmaclen == len && memcmp(hmac, packet + i + 2, len) == 0;
             if(ok)
                 return 1;
             rc = 0;
@@ -285,3 +394,13 @@ check_hmac(const unsigned char *packet, int packetlen, int bodylen,
     }
     return rc;
 }
+
+int
+check_hmac(const unsigned char *packet, int packetlen, int bodylen,
+           const unsigned char *src, const unsigned char *dst,
+           struct interface *ifp)
+{
+    debugf("check_hmac %s -> %s\n",
+           format_address(src), format_address(dst));
+    return verify_hmac(packet, packetlen, bodylen, src, dst, ifp);
+}
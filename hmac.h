@@ -28,6 +28,9 @@ void release_key(struct key *key);
 struct key *add_key(char *id, int type, int len, unsigned char *value);
 int add_hmac(struct buffered *buf, struct interface *ifp,
              unsigned char *packet_header);
+int verify_hmac(const unsigned char *packet, int packetlen, int bodylen,
+                const unsigned char *src, const unsigned char *dst,
+                struct interface *ifp);
 int check_hmac(const unsigned char *packet, int packetlen, int bodylen,
                const unsigned char *src, const unsigned char *dst,
                struct interface *ifp);
@@ -0,0 +1,424 @@
+/*
+Copyright (c) 2007, 2008 by Juliusz Chroboczek
+Copyright (c) 2021 by Florian Wiedner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define HAVE_X86_ACCEL
+#elif defined(__aarch64__) && defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#include <arm_neon.h>
+#define HAVE_ARMV8_ACCEL
+#endif
+
+#include "babeld.h"
+#include "util.h"
+#include "hmac_accel.h"
+
+static int accel_initialised = 0;
+static void (*sha256_blocks)(uint32_t *h, const unsigned char *data,
+                             size_t n) = NULL;
+static void (*blake2s_compress)(uint32_t *h, const unsigned char *block,
+                                uint64_t t, int last) = NULL;
+/* What hmac_accel_init found, see hmac_accel_enable. */
+static void (*sha256_blocks_found)(uint32_t *h, const unsigned char *data,
+                                   size_t n) = NULL;
+static void (*blake2s_compress_found)(uint32_t *h, const unsigned char *block,
+                                      uint64_t t, int last) = NULL;
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static const uint32_t blake2s_iv[8] = {
+    0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+    0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19,
+};
+
+#ifdef HAVE_X86_ACCEL
+
+/* The state is kept as ABEF and CDGH, as expected by sha256rnds2. */
+__attribute__((target("sha,sse4.1")))
+static void
+sha256_blocks_shani(uint32_t *h, const unsigned char *data, size_t n)
+{
+    const __m128i mask =
+        _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i state0, state1, tmp, msg, abef, cdgh, w[4];
+    int i;
+
+    tmp = _mm_loadu_si128((const __m128i*)&h[0]);
+    state1 = _mm_loadu_si128((const __m128i*)&h[4]);
+    tmp = _mm_shuffle_epi32(tmp, 0xB1);
+    state1 = _mm_shuffle_epi32(state1, 0x1B);
+    state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+    while(n-- > 0) {
+        abef = state0;
+        cdgh = state1;
+        for(i = 0; i < 16; i++) {
+            if(i < 4)
+                w[i] = _mm_shuffle_epi8(
+                    _mm_loadu_si128((const __m128i*)(data + 16 * i)), mask);
+            else
+                w[i & 3] = _mm_sha256msg2_epu32(
+                    _mm_add_epi32(_mm_sha256msg1_epu32(w[i & 3],
+                                                       w[(i + 1) & 3]),
+                                  _mm_alignr_epi8(w[(i + 3) & 3],
+                                                  w[(i + 2) & 3], 4)),
+                    w[(i + 3) & 3]);
+            msg = _mm_add_epi32(w[i & 3],
+                                _mm_loadu_si128((const __m128i*)
+                                                &sha256_k[4 * i]));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+            msg = _mm_shuffle_epi32(msg, 0x0E);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+        }
+        state0 = _mm_add_epi32(state0, abef);
+        state1 = _mm_add_epi32(state1, cdgh);
+        data += 64;
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B);
+    state1 = _mm_shuffle_epi32(state1, 0xB1);
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+    state1 = _mm_alignr_epi8(state1, tmp, 8);
+    _mm_storeu_si128((__m128i*)&h[0], state0);
+    _mm_storeu_si128((__m128i*)&h[4], state1);
+}
+
+static const uint8_t blake2s_sigma[10][16] = {
+    {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+    { 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 },
+    { 11,  8, 12,  0,  5,  2, 15, 13, 10, 14,  3,  6,  7,  1,  9,  4 },
+    {  7,  9,  3,  1, 13, 12, 11, 14,  2,  6,  5, 10,  4,  0, 15,  8 },
+    {  9,  0,  5,  7,  2,  4, 10, 15, 14,  1, 11, 12,  6,  8,  3, 13 },
+    {  2, 12,  6, 10,  0, 11,  8,  3,  4, 13,  7,  5, 15, 14,  1,  9 },
+    { 12,  5,  1, 15, 14, 13,  4, 10,  0,  7,  6,  3,  9,  2,  8, 11 },
+    { 13, 11,  7, 14, 12,  1,  3,  9,  5,  0, 15,  4,  8,  6,  2, 10 },
+    {  6, 15, 14,  9, 11,  3,  0,  8, 12,  2, 13,  7,  1,  4, 10,  5 },
+    { 10,  2,  8,  4,  7,  6,  1,  5, 15, 11,  9, 14,  3, 12, 13,  0 },
+};
+
+/* One G function on all four columns (or diagonals) at once. */
+#define BLAKE2S_G(a, b, c, d, x, y)                                      \
+    do {                                                                \
+        a = _mm_add_epi32(_mm_add_epi32(a, x), b);                      \
+        d = _mm_shuffle_epi8(_mm_xor_si128(d, a), rot16);               \
+        c = _mm_add_epi32(c, d);                                        \
+        b = _mm_xor_si128(b, c);                                        \
+        b = _mm_or_si128(_mm_srli_epi32(b, 12), _mm_slli_epi32(b, 20)); \
+        a = _mm_add_epi32(_mm_add_epi32(a, y), b);                      \
+        d = _mm_shuffle_epi8(_mm_xor_si128(d, a), rot8);                \
+        c = _mm_add_epi32(c, d);                                        \
+        b = _mm_xor_si128(b, c);                                        \
+        b = _mm_or_si128(_mm_srli_epi32(b, 7), _mm_slli_epi32(b, 25));  \
+    } while(0)
+
+__attribute__((target("sse4.1")))
+static void
+blake2s_compress_sse41(uint32_t *h, const unsigned char *block,
+                       uint64_t t, int last)
+{
+    const __m128i rot16 =
+        _mm_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+    const __m128i rot8 =
+        _mm_setr_epi8(1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12);
+    __m128i row1, row2, row3, row4, h0, h1;
+    uint32_t m[16];
+    int r;
+
+    memcpy(m, block, 64);
+    h0 = row1 = _mm_loadu_si128((const __m128i*)&h[0]);
+    h1 = row2 = _mm_loadu_si128((const __m128i*)&h[4]);
+    row3 = _mm_loadu_si128((const __m128i*)&blake2s_iv[0]);
+    row4 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)&blake2s_iv[4]),
+                         _mm_setr_epi32((uint32_t)t, (uint32_t)(t >> 32),
+                                        last ? 0xFFFFFFFF : 0, 0));
+
+    for(r = 0; r < 10; r++) {
+        const uint8_t *s = blake2s_sigma[r];
+        BLAKE2S_G(row1, row2, row3, row4,
+                  _mm_setr_epi32(m[s[0]], m[s[2]], m[s[4]], m[s[6]]),
+                  _mm_setr_epi32(m[s[1]], m[s[3]], m[s[5]], m[s[7]]));
+        row2 = _mm_shuffle_epi32(row2, _MM_SHUFFLE(0, 3, 2, 1));
+        row3 = _mm_shuffle_epi32(row3, _MM_SHUFFLE(1, 0, 3, 2));
+        row4 = _mm_shuffle_epi32(row4, _MM_SHUFFLE(2, 1, 0, 3));
+        BLAKE2S_G(row1, row2, row3, row4,
+                  _mm_setr_epi32(m[s[8]], m[s[10]], m[s[12]], m[s[14]]),
+                  _mm_setr_epi32(m[s[9]], m[s[11]], m[s[13]], m[s[15]]));
+        row2 = _mm_shuffle_epi32(row2, _MM_SHUFFLE(2, 1, 0, 3));
+        row3 = _mm_shuffle_epi32(row3, _MM_SHUFFLE(1, 0, 3, 2));
+        row4 = _mm_shuffle_epi32(row4, _MM_SHUFFLE(0, 3, 2, 1));
+    }
+
+    _mm_storeu_si128((__m128i*)&h[0],
+                     _mm_xor_si128(h0, _mm_xor_si128(row1, row3)));
+    _mm_storeu_si128((__m128i*)&h[4],
+                     _mm_xor_si128(h1, _mm_xor_si128(row2, row4)));
+}
+
+#undef BLAKE2S_G
+
+#endif
+
+#ifdef HAVE_ARMV8_ACCEL
+
+__attribute__((target("+crypto")))
+static void
+sha256_blocks_armv8(uint32_t *h, const unsigned char *data, size_t n)
+{
+    uint32x4_t state0, state1, abcd, efgh, tmp, msg, w[4];
+    int i;
+
+    state0 = vld1q_u32(&h[0]);
+    state1 = vld1q_u32(&h[4]);
+
+    while(n-- > 0) {
+        abcd = state0;
+        efgh = state1;
+        for(i = 0; i < 16; i++) {
+            if(i < 4)
+                w[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 16 * i)));
+            else
+                w[i & 3] = vsha256su1q_u32(vsha256su0q_u32(w[i & 3],
+                                                           w[(i + 1) & 3]),
+                                           w[(i + 2) & 3], w[(i + 3) & 3]);
+            msg = vaddq_u32(w[i & 3], vld1q_u32(&sha256_k[4 * i]));
+            tmp = state0;
+            state0 = vsha256hq_u32(state0, state1, msg);
+            state1 = vsha256h2q_u32(state1, tmp, msg);
+        }
+        state0 = vaddq_u32(state0, abcd);
+        state1 = vaddq_u32(state1, efgh);
+        data += 64;
+    }
+
+    vst1q_u32(&h[0], state0);
+    vst1q_u32(&h[4], state1);
+}
+
+#endif
+
+void
+hmac_accel_init(void)
+{
+    if(accel_initialised)
+        return;
+    accel_initialised = 1;
+
+#if defined(HAVE_X86_ACCEL)
+    {
+        unsigned int eax, ebx, ecx, edx;
+        int sse41 = 0, sha = 0;
+        if(__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+            sse41 = (ecx & bit_SSE4_1) != 0;
+        if(__get_cpuid_max(0, NULL) >= 7 &&
+           __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+            sha = (ebx & bit_SHA) != 0;
+        if(sha && sse41)
+            sha256_blocks = sha256_blocks_shani;
+        if(sse41)
+            blake2s_compress = blake2s_compress_sse41;
+    }
+#elif defined(HAVE_ARMV8_ACCEL)
+    if(getauxval(AT_HWCAP) & HWCAP_SHA2)
+        sha256_blocks = sha256_blocks_armv8;
+#endif
+    sha256_blocks_found = sha256_blocks;
+    blake2s_compress_found = blake2s_compress;
+
+    debugf("MAC hashes: SHA-256 %s, BLAKE2s %s.\n",
+           sha256_blocks ? "accelerated" : "reference",
+           blake2s_compress ? "accelerated" : "reference");
+}
+
+/* Switches the backends found by hmac_accel_init on or off, so that the
+   MAC benchmark can compare them with the reference implementations.
+   Keys only get a state for the backends that are on when they are
+   added. */
+void
+hmac_accel_enable(int sha256, int blake2s)
+{
+    hmac_accel_init();
+    sha256_blocks = sha256 ? sha256_blocks_found : NULL;
+    blake2s_compress = blake2s ? blake2s_compress_found : NULL;
+}
+
+int
+sha256_accel_available(void)
+{
+    return sha256_blocks != NULL;
+}
+
+int
+blake2s_accel_available(void)
+{
+    return blake2s_compress != NULL;
+}
+
+void
+sha256_accel_init(struct sha256_accel *s)
+{
+    static const uint32_t h0[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+
+    memcpy(s->h, h0, sizeof(h0));
+    s->length = 0;
+    s->blocklen = 0;
+}
+
+void
+sha256_accel_update(struct sha256_accel *s,
+                    const unsigned char *data, size_t len)
+{
+    size_t n;
+
+    s->length += len;
+
+    if(s->blocklen > 0) {
+        n = MIN(len, (size_t)(64 - s->blocklen));
+        memcpy(s->block + s->blocklen, data, n);
+        s->blocklen += n;
+        data += n;
+        len -= n;
+        if(s->blocklen < 64)
+            return;
+        sha256_blocks(s->h, s->block, 1);
+        s->blocklen = 0;
+    }
+
+    if(len >= 64) {
+        sha256_blocks(s->h, data, len / 64);
+        data += len / 64 * 64;
+        len %= 64;
+    }
+
+    memcpy(s->block, data, len);
+    s->blocklen = len;
+}
+
+void
+sha256_accel_final(struct sha256_accel *s, unsigned char *digest)
+{
+    uint64_t bits = s->length * 8;
+    int i;
+
+    s->block[s->blocklen++] = 0x80;
+    if(s->blocklen > 56) {
+        memset(s->block + s->blocklen, 0, 64 - s->blocklen);
+        sha256_blocks(s->h, s->block, 1);
+        s->blocklen = 0;
+    }
+    memset(s->block + s->blocklen, 0, 56 - s->blocklen);
+    for(i = 0; i < 8; i++)
+        s->block[56 + i] = bits >> (56 - 8 * i);
+    sha256_blocks(s->h, s->block, 1);
+
+    for(i = 0; i < 8; i++) {
+        digest[4 * i] = s->h[i] >> 24;
+        digest[4 * i + 1] = s->h[i] >> 16;
+        digest[4 * i + 2] = s->h[i] >> 8;
+        digest[4 * i + 3] = s->h[i];
+    }
+}
+
+int
+blake2s_accel_init_key(struct blake2s_accel *s, int outlen,
+                       const unsigned char *key, int keylen)
+{
+    if(outlen < 1 || outlen > 32 || keylen < 0 || keylen > 32)
+        return -1;
+
+    memcpy(s->h, blake2s_iv, sizeof(blake2s_iv));
+    s->h[0] ^= 0x01010000 ^ (keylen << 8) ^ outlen;
+    s->t = 0;
+    s->outlen = outlen;
+    s->blocklen = 0;
+    if(keylen > 0) {
+        memset(s->block, 0, 64);
+        memcpy(s->block, key, keylen);
+        s->blocklen = 64;
+    }
+    return 0;
+}
+
+/* The last block must be compressed by blake2s_accel_final, so a full
+   block is only compressed once more data arrives. */
+void
+blake2s_accel_update(struct blake2s_accel *s,
+                     const unsigned char *data, size_t len)
+{
+    size_t n;
+
+    while(len > 0) {
+        if(s->blocklen == 64) {
+            s->t += 64;
+            blake2s_compress(s->h, s->block, s->t, 0);
+            s->blocklen = 0;
+        }
+        n = MIN(len, (size_t)(64 - s->blocklen));
+        memcpy(s->block + s->blocklen, data, n);
+        s->blocklen += n;
+        data += n;
+        len -= n;
+    }
+}
+
+void
+blake2s_accel_final(struct blake2s_accel *s, unsigned char *out)
+{
+    int i;
+
+    s->t += s->blocklen;
+    memset(s->block + s->blocklen, 0, 64 - s->blocklen);
+    blake2s_compress(s->h, s->block, s->t, 1);
+
+    for(i = 0; i < s->outlen; i++)
+        out[i] = s->h[i / 4] >> (8 * (i % 4));
+}
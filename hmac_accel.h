@@ -0,0 +1,57 @@
+/*
+Copyright (c) 2007, 2008 by Juliusz Chroboczek
+Copyright (c) 2021 by Florian Wiedner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* Optional hardware implementations of the hashes used for MACs.  They
+   are only used if hmac_accel_init finds the corresponding CPU
+   features, otherwise hmac.c uses the reference implementations. */
+
+struct sha256_accel {
+    uint32_t h[8];
+    uint64_t length;
+    unsigned char block[64];
+    int blocklen;
+};
+
+struct blake2s_accel {
+    uint32_t h[8];
+    uint64_t t;
+    unsigned char block[64];
+    int blocklen;
+    int outlen;
+};
+
+void hmac_accel_init(void);
+void hmac_accel_enable(int sha256, int blake2s);
+int sha256_accel_available(void);
+int blake2s_accel_available(void);
+
+void sha256_accel_init(struct sha256_accel *s);
+void sha256_accel_update(struct sha256_accel *s,
+                         const unsigned char *data, size_t len);
+void sha256_accel_final(struct sha256_accel *s, unsigned char *digest);
+
+int blake2s_accel_init_key(struct blake2s_accel *s, int outlen,
+                           const unsigned char *key, int keylen);
+void blake2s_accel_update(struct blake2s_accel *s,
+                          const unsigned char *data, size_t len);
+void blake2s_accel_final(struct blake2s_accel *s, unsigned char *out);
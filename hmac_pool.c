@@ -0,0 +1,210 @@
+/*
+Copyright (c) 2007, 2008 by Juliusz Chroboczek
+Copyright (c) 2021 by Florian Wiedner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+
+#include "babeld.h"
+#include "util.h"
+#include "interface.h"
+#include "hmac.h"
+#include "hmac_pool.h"
+
+#define MAX_POOL_THREADS 16
+
+int hmac_pool_threads = 0;
+
+static pthread_t pool[MAX_POOL_THREADS];
+static int pool_size = 0;
+
+/* A batch lives on the stack of hmac_pool_verify.  Threads grab jobs
+   through next, which belongs to the batch, so that a thread that is
+   late for one batch can never take a job from the following one. */
+struct hmac_batch {
+    struct hmac_job *jobs;
+    int n;
+    atomic_int next;
+};
+
+/* Everything below is protected by pool_mutex. */
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static struct hmac_batch *batch = NULL;
+static int pending = 0;         /* jobs of the current batch not done yet */
+static int active = 0;          /* threads holding a pointer to the batch */
+static unsigned int generation = 0;
+static int stopping = 0;
+
+static void
+verify_job(struct hmac_job *job)
+{
+    int bodylen;
+
+    if(job->ifp == NULL || job->ifp->key == NULL ||
+       job->packetlen < 4 || job->packet[0] != 42 || job->packet[1] != 2)
+        return;
+
+    DO_NTOHS(bodylen, job->packet + 2);
+    if(bodylen + 4 > job->packetlen)
+        bodylen = job->packetlen - 4;
+
+    job->rc = verify_hmac(job->packet, job->packetlen, bodylen,
+                          job->from, job->to, job->ifp);
+}
+
+static int
+run_jobs(struct hmac_batch *b)
+{
+    int i, count = 0;
+
+    while((i = atomic_fetch_add(&b->next, 1)) < b->n) {
+        verify_job(&b->jobs[i]);
+        count++;
+    }
+    return count;
+}
+
+static void *
+pool_thread(void *arg)
+{
+    unsigned int seen;
+    struct hmac_batch *b;
+    int count;
+
+    pthread_mutex_lock(&pool_mutex);
+    seen = generation;
+    while(1) {
+        while(generation == seen && !stopping)
+            pthread_cond_wait(&work_cond, &pool_mutex);
+        if(stopping)
+            break;
+        seen = generation;
+        /* The main thread may have done all the work already. */
+        b = batch;
+        if(b == NULL)
+            continue;
+        active++;
+        pthread_mutex_unlock(&pool_mutex);
+
+        count = run_jobs(b);
+
+        pthread_mutex_lock(&pool_mutex);
+        pending -= count;
+        active--;
+        if(pending == 0 && active == 0)
+            pthread_cond_signal(&done_cond);
+    }
+    pthread_mutex_unlock(&pool_mutex);
+    return NULL;
+}
+
+int
+hmac_pool_start(void)
+{
+    int i, rc;
+
+    if(hmac_pool_threads <= 0 || pool_size > 0)
+        return 0;
+
+    stopping = 0;
+    for(i = 0; i < hmac_pool_threads && i < MAX_POOL_THREADS; i++) {
+        rc = pthread_create(&pool[i], NULL, pool_thread, NULL);
+        if(rc != 0) {
+            errno = rc;
+            hmac_pool_stop();
+            return -1;
+        }
+        pool_size++;
+    }
+    return 1;
+}
+
+void
+hmac_pool_stop(void)
+{
+    int i;
+
+    if(pool_size == 0)
+        return;
+
+    pthread_mutex_lock(&pool_mutex);
+    stopping = 1;
+    pthread_cond_broadcast(&work_cond);
+    pthread_mutex_unlock(&pool_mutex);
+
+    for(i = 0; i < pool_size; i++)
+        pthread_join(pool[i], NULL);
+    pool_size = 0;
+}
+
+/* Check the MACs of a batch of packets, filling in the rc field of each
+   job.  The main thread takes its share of the work, and doesn't return
+   until every job is done and no thread looks at the batch any more. */
+void
+hmac_pool_verify(struct hmac_job *jobs, int n)
+{
+    struct hmac_batch b;
+    int i, keyed = 0, count;
+
+    if(pool_size == 0)
+        return;
+
+    for(i = 0; i < n; i++) {
+        if(jobs[i].ifp != NULL && jobs[i].ifp->key != NULL)
+            keyed++;
+    }
+    /* Not worth waking anybody up. */
+    if(keyed < 2)
+        return;
+
+    b.jobs = jobs;
+    b.n = n;
+    atomic_init(&b.next, 0);
+
+    pthread_mutex_lock(&pool_mutex);
+    while(active > 0)
+        pthread_cond_wait(&done_cond, &pool_mutex);
+    batch = &b;
+    pending = n;
+    generation++;
+    pthread_cond_broadcast(&work_cond);
+    pthread_mutex_unlock(&pool_mutex);
+
+    count = run_jobs(&b);
+
+    pthread_mutex_lock(&pool_mutex);
+    pending -= count;
+    /* Threads only pick up the batch while it is published, and must be
+       done with it before it goes out of scope. */
+    while(pending > 0 || active > 0)
+        pthread_cond_wait(&done_cond, &pool_mutex);
+    batch = NULL;
+    pthread_mutex_unlock(&pool_mutex);
+}
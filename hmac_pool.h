@@ -0,0 +1,45 @@
+/*
+Copyright (c) 2007, 2008 by Juliusz Chroboczek
+Copyright (c) 2021 by Florian Wiedner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* A pool of threads that checks the MACs of a batch of received packets
+   in parallel.  Only the MAC is computed off the main thread: the PC and
+   index checks update the neighbour table and may send challenges, so
+   they are still done by parse_packet, in the order the packets were
+   received. */
+
+#define HMAC_UNCHECKED 2
+
+struct hmac_job {
+    const unsigned char *from;
+    const unsigned char *to;
+    const unsigned char *packet;
+    int packetlen;
+    struct interface *ifp;      /* NULL if the packet is to be dropped */
+    int rc;                     /* result of check_hmac, or HMAC_UNCHECKED */
+};
+
+extern int hmac_pool_threads;
+
+int hmac_pool_start(void);
+void hmac_pool_stop(void);
+void hmac_pool_verify(struct hmac_job *jobs, int n);
@@ -43,40 +43,160 @@ THE SOFTWARE.
 #include "route.h"
 #include "configuration.h"
 #include "local.h"
+#include "timer.h"
 #include "xroute.h"
 #include "hmac.h"
 
 #define MIN_MTU 512
 
 struct interface *interfaces = NULL;
+static struct interface *last_interface = NULL;
 
-static struct interface *
-last_interface(void)
+/* Interfaces are also hashed by name and by ifindex, so that neither
+   the receive path nor kernel notifications need to walk the list.
+   Interfaces without an ifindex are only in the name table. */
+static struct interface **if_name_table = NULL, **if_index_table = NULL;
+static int if_buckets = 0, num_interfaces = 0;
+
+/* Interfaces with IF_CHANGED set, most recently marked first. */
+static struct interface *changed_interfaces = NULL;
+
+static unsigned int
+interface_name_hash(const char *name)
+{
+    unsigned int h = 2166136261U;
+    int i;
+
+    for(i = 0; i < IF_NAMESIZE && name[i] != '\0'; i++)
+        h = (h ^ (unsigned char)name[i]) * 16777619U;
+    return h;
+}
+
+static void
+link_interface_index(struct interface *ifp)
+{
+    unsigned int b;
+
+    if(ifp->ifindex == 0)
+        return;
+    b = ifp->ifindex & (if_buckets - 1);
+    ifp->index_next = if_index_table[b];
+    if_index_table[b] = ifp;
+}
+
+static void
+unlink_interface_index(struct interface *ifp)
+{
+    struct interface **p;
+
+    if(ifp->ifindex == 0)
+        return;
+    p = &if_index_table[ifp->ifindex & (if_buckets - 1)];
+    while(*p != ifp)
+        p = &(*p)->index_next;
+    *p = ifp->index_next;
+}
+
+static int
+resize_interface_tables(int buckets)
+{
+    struct interface **new_names, **new_indices;
+    struct interface *ifp;
+
+    new_names = calloc(buckets, sizeof(struct interface*));
+    new_indices = calloc(buckets, sizeof(struct interface*));
+    if(new_names == NULL || new_indices == NULL) {
+        free(new_names);
+        free(new_indices);
+        return -1;
+    }
+
+    free(if_name_table);
+    free(if_index_table);
+    if_name_table = new_names;
+    if_index_table = new_indices;
+    if_buckets = buckets;
+
+    FOR_ALL_INTERFACES(ifp) {
+        unsigned int b = interface_name_hash(ifp->name) & (buckets - 1);
+        ifp->name_next = if_name_table[b];
+        if_name_table[b] = ifp;
+        link_interface_index(ifp);
+    }
+    return 1;
+}
+
+struct interface *
+find_interface(const char *ifname)
 {
-    struct interface *ifp = interfaces;
+    struct interface *ifp;
 
-    if(!ifp)
+    if(num_interfaces == 0)
         return NULL;
 
-    while(ifp->next)
-        ifp = ifp->next;
+    ifp = if_name_table[interface_name_hash(ifname) & (if_buckets - 1)];
+    while(ifp) {
+        if(strncmp(ifp->name, ifname, IF_NAMESIZE) == 0)
+            return ifp;
+        ifp = ifp->name_next;
+    }
+    return NULL;
+}
 
-    return ifp;
+struct interface *
+find_interface_by_ifindex(unsigned int ifindex)
+{
+    struct interface *ifp;
+
+    if(num_interfaces == 0 || ifindex == 0)
+        return NULL;
+
+    ifp = if_index_table[ifindex & (if_buckets - 1)];
+    while(ifp) {
+        if(ifp->ifindex == ifindex)
+            return ifp;
+        ifp = ifp->index_next;
+    }
+    return NULL;
+}
+
+void
+set_interface_ifindex(struct interface *ifp, unsigned int ifindex)
+{
+    unlink_interface_index(ifp);
+    ifp->ifindex = ifindex;
+    link_interface_index(ifp);
+}
+
+void
+mark_interface_changed(struct interface *ifp)
+{
+    if(ifp->flags & IF_CHANGED)
+        return;
+    ifp->flags |= IF_CHANGED;
+    ifp->changed_next = changed_interfaces;
+    changed_interfaces = ifp;
 }
 
 struct interface *
 add_interface(char *ifname, struct interface_conf *if_conf)
 {
     struct interface *ifp;
+    unsigned int b;
 
-    FOR_ALL_INTERFACES(ifp) {
-        if(strcmp(ifp->name, ifname) == 0) {
-            if(if_conf)
-                fprintf(stderr,
-                        "Warning: attempting to add existing interface (%s), "
-                        "new configuration ignored.\n", ifname);
-            return ifp;
-        }
+    ifp = find_interface(ifname);
+    if(ifp) {
+        if(if_conf)
+            fprintf(stderr,
+                    "Warning: attempting to add existing interface (%s), "
+                    "new configuration ignored.\n", ifname);
+        return ifp;
+    }
+
+    if(num_interfaces >= if_buckets) {
+        resize_interface_tables(if_buckets < 1 ? 16 : 2 * if_buckets);
+        if(if_buckets < 1)
+            return NULL;
     }
 
     ifp = calloc(1, sizeof(struct interface));
@@ -90,7 +210,13 @@ add_interface(char *ifname, struct interface_conf *if_conf)
     if(interfaces == NULL)
         interfaces = ifp;
     else
-        last_interface()->next = ifp;
+        last_interface->next = ifp;
+    last_interface = ifp;
+
+    b = interface_name_hash(ifp->name) & (if_buckets - 1);
+    ifp->name_next = if_name_table[b];
+    if_name_table[b] = ifp;
+    num_interfaces++;
 
     local_notify_interface(ifp, LOCAL_ADD);
 
@@ -100,31 +226,46 @@ add_interface(char *ifname, struct interface_conf *if_conf)
 int
 flush_interface(char *ifname)
 {
-    struct interface *ifp, *prev;
-
-    prev = NULL;
-    ifp = interfaces;
-    while(ifp) {
-        if(strcmp(ifp->name, ifname) == 0)
-            break;
-        prev = ifp;
-        ifp = ifp->next;
-    }
+    struct interface *ifp, *prev, **p;
 
+    ifp = find_interface(ifname);
     if(ifp == NULL)
         return 0;
 
     interface_updown(ifp, 0);
-    if(prev)
-        prev->next = ifp->next;
-    else
-        interfaces = ifp->next;
+    while(ifp->neighs)
+        flush_neighbour(ifp->neighs);
+
+    prev = NULL;
+    p = &interfaces;
+    while(*p != ifp) {
+        prev = *p;
+        p = &(*p)->next;
+    }
+    *p = ifp->next;
+    if(last_interface == ifp)
+        last_interface = prev;
+
+    p = &if_name_table[interface_name_hash(ifp->name) & (if_buckets - 1)];
+    while(*p != ifp)
+        p = &(*p)->name_next;
+    *p = ifp->name_next;
+    unlink_interface_index(ifp);
+    num_interfaces--;
+
+    if(ifp->flags & IF_CHANGED) {
+        p = &changed_interfaces;
+        while(*p != ifp)
+            p = &(*p)->changed_next;
+        *p = ifp->changed_next;
+    }
 
     if(ifp->conf != NULL && ifp->conf != default_interface_conf)
         flush_ifconf(ifp->conf);
 
     local_notify_interface(ifp, LOCAL_FLUSH);
 
+    cancel_timers(ifp);
     free(ifp->ipv4);
     free(ifp);
 
@@ -340,6 +481,8 @@ interface_updown(struct interface *ifp, int up)
             goto fail;
         }
         ifp->buf.hello = -1;
+        ifp->buf.timer_type = TIMER_INTERFACE_BUF;
+        ifp->buf.timer_owner = ifp;
 
         rc = resize_receive_buffer(mtu);
         if(rc < 0)
@@ -440,6 +583,11 @@ interface_updown(struct interface *ifp, int up)
         if(ifp->max_rtt_penalty == 0) // && type == IF_TYPE_TUNNEL is removed to have a default penalty of 96 for every interface
             ifp->max_rtt_penalty = 96;
 
+        ifp->pacing.rate = IF_CONF(ifp, rate_limit);
+        ifp->pacing.packet_rate = IF_CONF(ifp, packet_rate_limit);
+        ifp->pacing.last.tv_sec = 0;
+        ifp->pacing.last.tv_usec = 0;
+
         if(IF_CONF(ifp, enable_timestamps) == CONFIG_YES)
             ifp->flags |= IF_TIMESTAMPS;
         else if(IF_CONF(ifp, enable_timestamps) == CONFIG_NO)
@@ -497,7 +645,9 @@ interface_updown(struct interface *ifp, int up)
                ifp->ipv4 ? ", IPv4" : "");
 
         set_timeout(&ifp->hello_timeout, ifp->hello_interval);
+        schedule_timer(&ifp->hello_timeout, TIMER_HELLO, ifp);
         set_timeout(&ifp->update_timeout, ifp->update_interval);
+        schedule_timer(&ifp->update_timeout, TIMER_UPDATE, ifp);
         send_hello(ifp);
         if(rc > 0)
             send_update(ifp, 0, NULL, 0, NULL, 0, NULL);
@@ -506,13 +656,15 @@ interface_updown(struct interface *ifp, int up)
         ifp->flags &= ~IF_UP;
         flush_interface_routes(ifp, 0);
         ifp->buf.len = 0;
+        ifp->buf.link_len = 0;
         ifp->buf.size = 0;
         free(ifp->buf.buf);
-        ifp->num_buffered_updates = 0;
-        ifp->update_bufsize = 0;
-        if(ifp->buffered_updates)
-            free(ifp->buffered_updates);
-        ifp->buffered_updates = NULL;
+        free_update_set(&ifp->updates);
+        discard_paced_packets(ifp);
+        discard_requests(&ifp->buf);
+        memset(&ifp->update_cursor, 0, sizeof(ifp->update_cursor));
+        ifp->update_slice_timeout.tv_sec = 0;
+        ifp->update_slice_timeout.tv_usec = 0;
         ifp->buf.buf = NULL;
         if(ifp->ifindex > 0) {
             memset(&mreq, 0, sizeof(mreq));
@@ -556,42 +708,93 @@ interface_ll_address(struct interface *ifp, const unsigned char *address)
     return 0;
 }
 
+/* Returns 1 if the ifindex changed. */
+static int
+check_interface(struct interface *ifp)
+{
+    int rc, ifindex_changed = 0;
+    unsigned int ifindex;
+
+    ifindex = if_nametoindex(ifp->name);
+    if(ifindex != ifp->ifindex) {
+        debugf("Noticed ifindex change for %s.\n", ifp->name);
+        interface_updown(ifp, 0);
+        set_interface_ifindex(ifp, ifindex);
+        ifindex_changed = 1;
+    }
+
+    if(ifp->ifindex > 0)
+        rc = kernel_interface_operational(ifp->name, ifp->ifindex);
+    else
+        rc = 0;
+    if((rc > 0) != if_up(ifp)) {
+        debugf("Noticed status change for %s.\n", ifp->name);
+        interface_updown(ifp, rc > 0);
+    }
+
+    if(if_up(ifp)) {
+        /* Bother, said Pooh.  We should probably check for a change
+           in IPv4 addresses at this point. */
+        check_link_local_addresses(ifp);
+        rc = check_interface_ipv4(ifp);
+        if(rc > 0) {
+            send_multicast_request(ifp, NULL, 0, NULL, 0, NULL);
+            send_update(ifp, 0, NULL, 0, NULL, 0, NULL);
+        }
+    }
+
+    return ifindex_changed;
+}
+
 void
 check_interfaces(void)
 {
     struct interface *ifp;
-    int rc, ifindex_changed = 0;
-    unsigned int ifindex;
+    int ifindex_changed = 0;
+
+    /* This checks the changed interfaces too. */
+    while(changed_interfaces) {
+        changed_interfaces->flags &= ~IF_CHANGED;
+        changed_interfaces = changed_interfaces->changed_next;
+    }
 
     FOR_ALL_INTERFACES(ifp) {
-        ifindex = if_nametoindex(ifp->name);
-        if(ifindex != ifp->ifindex) {
-            debugf("Noticed ifindex change for %s.\n", ifp->name);
-            interface_updown(ifp, 0);
-            ifp->ifindex = ifindex;
+        if(check_interface(ifp))
             ifindex_changed = 1;
-        }
+    }
 
-        if(ifp->ifindex > 0)
-            rc = kernel_interface_operational(ifp->name, ifp->ifindex);
-        else
-            rc = 0;
-        if((rc > 0) != if_up(ifp)) {
-            debugf("Noticed status change for %s.\n", ifp->name);
-            interface_updown(ifp, rc > 0);
-        }
+    if(ifindex_changed)
+        renumber_filters();
+}
 
-        if(if_up(ifp)) {
-            /* Bother, said Pooh.  We should probably check for a change
-               in IPv4 addresses at this point. */
-            check_link_local_addresses(ifp);
+void
+check_interface_channels(void)
+{
+    struct interface *ifp;
+
+    FOR_ALL_INTERFACES(ifp) {
+        if(if_up(ifp))
             check_interface_channel(ifp);
-            rc = check_interface_ipv4(ifp);
-            if(rc > 0) {
-                send_multicast_request(ifp, NULL, 0, NULL, 0, NULL);
-                send_update(ifp, 0, NULL, 0, NULL, 0, NULL);
-            }
-        }
+    }
+}
+
+/* Only check the interfaces marked with IF_CHANGED, which are on their
+   own list.  This is called once per loop iteration, so that a burst of
+   link notifications causes a single check of each interface concerned,
+   and costs nothing when no interface changed. */
+void
+check_changed_interfaces(void)
+{
+    struct interface *ifp;
+    int ifindex_changed = 0;
+
+    /* Checking an interface may mark it again, so unlink it first. */
+    while(changed_interfaces) {
+        ifp = changed_interfaces;
+        changed_interfaces = ifp->changed_next;
+        ifp->flags &= ~IF_CHANGED;
+        if(check_interface(ifp))
+            ifindex_changed = 1;
     }
 
     if(ifindex_changed)
@@ -21,13 +21,61 @@ THE SOFTWARE.
 */
 
 struct buffered_update {
-    unsigned char id[8];
     unsigned char prefix[16];
     unsigned char src_prefix[16];
     unsigned char plen;
     unsigned char src_plen;
     unsigned char tos[1];
-    unsigned char pad[2];
+    unsigned char v4;
+    /* Index of the next update in the same group, or -1. */
+    int next;
+    /* Result of the lookup done on insertion, cleared by
+       invalidate_buffered_update when the route or xroute changes.  If
+       self is set, the update is for an xroute with the given metric. */
+    char valid;
+    char self;
+    unsigned short metric;
+    struct babel_route *route;
+};
+
+/* Updates with the same router-id and address family, which are sent
+   together in order to make the best use of router-id compression.  They
+   are chained in the order in which they go out. */
+struct update_group {
+    unsigned char id[8];
+    unsigned char v4;
+    int first, last;
+};
+
+/* The set of updates pending on an interface.  Updates are deduplicated
+   and chained to their group on insertion, so that flushing is a walk
+   over the groups that neither sorts nor looks routes up again. */
+struct update_set {
+    struct buffered_update *updates;
+    int num_updates;
+    struct update_group *groups;
+    int num_groups;
+    /* Size of the updates and groups arrays. */
+    int size;
+    /* Open-addressed hash tables of indices, -1 if empty; the first
+       hashsize entries index updates, the remaining ones groups. */
+    int *hash;
+    int hashsize;
+    /* Receive time and DSCP of the oldest traced update in the set. */
+    unsigned long long trace_start;
+    unsigned char trace_tos;
+};
+
+/* Position of a periodic update that is being sent in slices.  The next
+   slice starts at the first installed route not smaller than this key. */
+struct update_cursor {
+    unsigned char prefix[16];
+    unsigned char plen;
+    unsigned char src_prefix[16];
+    unsigned char src_plen;
+    unsigned char tos[1];
+    char active;
+    int slice;
 };
 
 #define IF_TYPE_DEFAULT 0
@@ -36,12 +84,16 @@ struct buffered_update {
 #define IF_TYPE_TUNNEL 3
 
 /* If you modify this structure, also modify the merge_ifconf function. */
+struct key_state;
+
 struct key {
     char *id;
     int type;
     int len;
     unsigned char *value;
     unsigned short ref_count;
+    /* Hash state after the key has been absorbed, see hmac.c. */
+    struct key_state *state;
 };
 
 struct interface_conf {
@@ -62,6 +114,8 @@ struct interface_conf {
     unsigned int rtt_min;
     unsigned int rtt_max;
     unsigned int max_rtt_penalty;
+    unsigned int rate_limit;
+    unsigned int packet_rate_limit;
     struct key *key;
     struct interface_conf *next;
 };
@@ -90,6 +144,9 @@ struct interface_conf {
 #define IF_ACCEPT_BAD_SIGNATURES (1 << 8)
 /* Use Babel over DTLS on this interface. */
 #define IF_DTLS (1 << 9)
+/* The kernel notified us of a change, and the interface is on the list
+   walked by check_changed_interfaces. */
+#define IF_CHANGED (1 << 10)
 
 /* Only INTERFERING can appear on the wire. */
 #define IF_CHANNEL_UNKNOWN 0
@@ -112,12 +169,62 @@ struct buffered {
     /* Relative position of the Hello message in the send buffer, or
        (-1) if there is none. */
     int hello;
+    /* Length of the link-maintenance TLVs, which are kept at the start
+       of the buffer, before any routing TLVs. */
+    int link_len;
+    /* Buffer holds retractions, which may overdraw the pacing buckets. */
+    char priority;
+    /* Route requests to be added when the buffer is flushed. */
+    struct request_batch *requests;
+    /* Timer registered when a flush is scheduled, 0 for none. */
+    int timer_type;
+    void *timer_owner;
+    /* Receive time and DSCP of the oldest traced update buffered. */
+    unsigned long long trace_start;
+    unsigned char trace_tos;
+};
+
+/* A packet delayed by pacing.  It has no PC or HMAC yet, since these
+   must be computed when it is actually sent. */
+struct paced_packet {
+    struct sockaddr_in6 sin6;
+    unsigned char *buf;
+    int len;
+    int size;
+    struct timeval time;
+    unsigned long long trace_start;
+    unsigned char trace_tos;
+};
+
+#define PACING_QUEUE_MAX 256
+
+/* Token buckets limiting the rate of outgoing packets on an interface.
+   Tokens are counted in thousandths of a byte or of a packet. */
+struct pacing {
+    unsigned int rate;          /* bytes per second, 0 if unlimited */
+    unsigned int packet_rate;   /* packets per second, 0 if unlimited */
+    long long bytes;
+    long long packets;
+    struct timeval last;
+    struct timeval timeout;
+    /* Ring buffer of PACING_QUEUE_MAX deferred packets. */
+    struct paced_packet *queue;
+    int head, len;
+    unsigned long deferred;
+    unsigned long deferral_msecs;
+    unsigned int max_deferral_msecs;
+    unsigned long overflows;
 };
 
 #define INDEX_LEN 8
 
 struct interface {
     struct interface *next;
+    /* Chains of the name and ifindex hash tables. */
+    struct interface *name_next;
+    struct interface *index_next;
+    /* Next on the list of changed interfaces, valid if IF_CHANGED. */
+    struct interface *changed_next;
     struct interface_conf *conf;
     unsigned int ifindex;
     unsigned short flags;
@@ -126,14 +233,17 @@ struct interface {
     struct timeval hello_timeout;
     struct timeval update_timeout;
     struct timeval update_flush_timeout;
+    struct timeval update_slice_timeout;
     char name[IF_NAMESIZE];
     unsigned char *ipv4;
     int numll;
     unsigned char (*ll)[16];
     struct buffered buf;
-    struct buffered_update *buffered_updates;
-    int num_buffered_updates;
-    int update_bufsize;
+    /* Neighbours on this interface, linked through if_next. */
+    struct neighbour *neighs;
+    struct pacing pacing;
+    struct update_set updates;
+    struct update_cursor update_cursor;
     time_t last_update_time;
     unsigned short hello_seqno;
     unsigned hello_interval;
@@ -163,11 +273,17 @@ if_up(struct interface *ifp)
     return !!(ifp->flags & IF_UP);
 }
 
+struct interface *find_interface(const char *ifname);
+struct interface *find_interface_by_ifindex(unsigned int ifindex);
 struct interface *add_interface(char *ifname, struct interface_conf *if_conf);
 int flush_interface(char *ifname);
+void set_interface_ifindex(struct interface *ifp, unsigned int ifindex);
+void mark_interface_changed(struct interface *ifp);
 unsigned jitter(struct buffered *buf, int urgent);
 unsigned update_jitter(struct interface *ifp, int urgent);
 void set_timeout(struct timeval *timeout, int msecs);
 int interface_updown(struct interface *ifp, int up);
 int interface_ll_address(struct interface *ifp, const unsigned char *address);
 void check_interfaces(void);
+void check_interface_channels(void);
+void check_changed_interfaces(void);
@@ -45,6 +45,7 @@ struct kernel_addr {
 
 struct kernel_link {
     char *ifname;
+    unsigned int ifindex;
 };
 
 struct kernel_filter {
@@ -71,6 +72,7 @@ struct kernel_filter {
 #endif
 
 extern int export_table, import_tables[MAX_IMPORT_TABLES], import_table_count;
+extern int kernel_socket_buffer_size;
 
 int add_import_table(int table);
 
@@ -92,9 +94,11 @@ int kernel_route(int operation, int table,
                  const unsigned char *newgate, int newifindex,
                  unsigned int newmetric, int newtable);
 int kernel_dump(int operation, struct kernel_filter *filter);
+/* Returns the CHANGE_* tables for which notifications were lost. */
 int kernel_callback(struct kernel_filter *filter);
 int if_eui64(char *ifname, int ifindex, unsigned char *eui);
 int gettime(struct timeval *tv);
 int read_random_bytes(void *buf, int len);
 int kernel_older_than(const char *sysname, int version, int sub_version);
 int kernel_has_ipv6_subtrees(void);
+int kernel_has_link_events(void);
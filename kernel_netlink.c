@@ -76,6 +76,7 @@ THE SOFTWARE.
     } while(0)
 
 int export_table = -1, import_tables[MAX_IMPORT_TABLES], import_table_count = 0;
+int kernel_socket_buffer_size = 512 * 1024;
 
 struct sysctl_setting {
     char *name;
@@ -223,22 +224,36 @@ write_proc(char *filename, int value)
     return 1;
 }
 
+/* Each socket has its own receive buffer, since routes may be programmed
+   from the kernel worker thread.  It is grown on demand when the kernel
+   hands us a datagram that doesn't fit, and never shrunk. */
 struct netlink {
     unsigned short seqno;
     int sock;
     struct sockaddr_nl sockaddr;
     socklen_t socklen;
+    unsigned char *buf;
+    int bufsize;
 };
 
-static struct netlink nl_command = { 0, -1, {0}, 0 };
-static struct netlink nl_listen = { 0, -1, {0}, 0 };
+#define NETLINK_BUFSIZE (64 * 1024)
+
+/* nl_command is used for dumps, nl_route for route changes only, so that
+   kernel_route can run in a different thread than kernel_dump. */
+static struct netlink nl_command = { 0, -1, {0}, 0, NULL, 0 };
+static struct netlink nl_route = { 0, -1, {0}, 0, NULL, 0 };
+/* Route and rule notifications come in bursts as large as the routing
+   table, so they are received apart from link and address notifications;
+   an overrun of either socket only loses the tables that it carries. */
+static struct netlink nl_listen = { 0, -1, {0}, 0, NULL, 0 };
+static struct netlink nl_listen_link = { 0, -1, {0}, 0, NULL, 0 };
 static int nl_setup = 0;
 
 static int
 netlink_socket(struct netlink *nl, uint32_t groups)
 {
     int rc;
-    int rcvsize = 512 * 1024;
+    int rcvsize = kernel_socket_buffer_size;
 
     nl->sock = socket(PF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
     if(nl->sock < 0)
@@ -301,7 +316,7 @@ netlink_read(struct netlink *nl, struct netlink *nl_ignore, int answer,
     /* 'answer' must be true when we just have send a request on 'nl_socket' */
 
     /* 'nl_ignore' is used in kernel_callback to ignore message originating  */
-    /*  from 'nl_command' while reading 'nl_listen'                          */
+    /*  from 'nl_route' while reading 'nl_listen'                            */
 
     /* Return code :                                       */
     /* -1 : error                                          */
@@ -316,7 +331,14 @@ netlink_read(struct netlink *nl, struct netlink *nl_ignore, int answer,
     int done = 0;
     int skip = 0;
 
-    struct nlmsghdr buf[8192/sizeof(struct nlmsghdr)];
+    if(nl->buf == NULL) {
+        nl->buf = malloc(NETLINK_BUFSIZE);
+        if(nl->buf == NULL) {
+            perror("malloc(netlink)");
+            return -1;
+        }
+        nl->bufsize = NETLINK_BUFSIZE;
+    }
 
     memset(&nladdr, 0, sizeof(nladdr));
     nladdr.nl_family = AF_NETLINK;
@@ -327,11 +349,12 @@ netlink_read(struct netlink *nl, struct netlink *nl_ignore, int answer,
     msg.msg_iov = &iov;
     msg.msg_iovlen = 1;
 
-    iov.iov_base = &buf;
-
     do {
-        iov.iov_len = sizeof(buf);
-        len = recvmsg(nl->sock, &msg, 0);
+        /* Peek at the size of the next datagram, so that we never lose
+           the tail of a large dump. */
+        iov.iov_base = nl->buf;
+        iov.iov_len = nl->bufsize;
+        len = recvmsg(nl->sock, &msg, MSG_PEEK | MSG_TRUNC);
 
         if(len < 0 && (errno == EAGAIN || errno == EINTR)) {
             int rc;
@@ -340,11 +363,37 @@ netlink_read(struct netlink *nl, struct netlink *nl_ignore, int answer,
                 if(rc == 0)
                     errno = EAGAIN;
             } else {
-                len = recvmsg(nl->sock, &msg, 0);
+                len = recvmsg(nl->sock, &msg, MSG_PEEK | MSG_TRUNC);
+            }
+        }
+
+        if(len > nl->bufsize) {
+            unsigned char *new_buf;
+            int n = nl->bufsize;
+            while(n < len)
+                n *= 2;
+            new_buf = realloc(nl->buf, n);
+            if(new_buf == NULL) {
+                perror("realloc(netlink)");
+            } else {
+                nl->buf = new_buf;
+                nl->bufsize = n;
             }
         }
 
-        if(len < 0) {
+        if(len >= 0) {
+            iov.iov_base = nl->buf;
+            iov.iov_len = nl->bufsize;
+            len = recvmsg(nl->sock, &msg, 0);
+        }
+
+        if(len < 0 && errno == ENOBUFS) {
+            /* The kernel dropped notifications; our view of its tables
+               is stale, and the caller must dump them again. */
+            fprintf(stderr, "netlink_read: receive buffer overrun.\n");
+            errno = ENOBUFS;
+            return -1;
+        } else if(len < 0) {
             perror("netlink_read: recvmsg()");
             return -1;
         } else if(len == 0) {
@@ -362,7 +411,7 @@ netlink_read(struct netlink *nl, struct netlink *nl_ignore, int answer,
 
         kdebugf("Netlink message: ");
 
-        for(nh = (struct nlmsghdr *)buf;
+        for(nh = (struct nlmsghdr *)nl->buf;
             NLMSG_OK(nh, len);
             nh = NLMSG_NEXT(nh, len)) {
             kdebugf("%s{seq:%d}", (nh->nlmsg_flags & NLM_F_MULTI) ? "[multi] " : "",
@@ -392,9 +441,6 @@ netlink_read(struct netlink *nl, struct netlink *nl_ignore, int answer,
                     errno = -err->error;
                     return -1;
                 }
-            } else if(nh->nlmsg_type == RTM_NEWLINK || nh->nlmsg_type == RTM_DELLINK ) {
-                kdebugf("detected an interface change via netlink - triggering babeld interface check\n");
-                check_interfaces();
             } else if(skip) {
                 kdebugf("(skip)");
             } if(filter) {
@@ -423,7 +469,7 @@ netlink_read(struct netlink *nl, struct netlink *nl_ignore, int answer,
 }
 
 static int
-netlink_talk(struct nlmsghdr *nh)
+netlink_talk(struct netlink *nl, struct nlmsghdr *nh)
 {
 
     int rc;
@@ -445,19 +491,19 @@ netlink_talk(struct nlmsghdr *nh)
     iov.iov_len = nh->nlmsg_len;
 
     nh->nlmsg_flags |= NLM_F_ACK;
-    nh->nlmsg_seq = ++nl_command.seqno;
+    nh->nlmsg_seq = ++nl->seqno;
 
     kdebugf("Sending seqno %d from address %p (talk)\n",
-            nl_command.seqno, (void*)&nl_command.seqno);
+            nl->seqno, (void*)&nl->seqno);
 
-    rc = sendmsg(nl_command.sock, &msg, 0);
+    rc = sendmsg(nl->sock, &msg, 0);
     if(rc < 0 && (errno == EAGAIN || errno == EINTR)) {
-        rc = wait_for_fd(1, nl_command.sock, 100);
+        rc = wait_for_fd(1, nl->sock, 100);
         if(rc <= 0) {
             if(rc == 0)
                 errno = EAGAIN;
         } else {
-            rc = sendmsg(nl_command.sock, &msg, 0);
+            rc = sendmsg(nl->sock, &msg, 0);
         }
     }
 
@@ -468,7 +514,7 @@ netlink_talk(struct nlmsghdr *nh)
         return -1;
     }
 
-    rc = netlink_read(&nl_command, NULL, 1, NULL); /* ACK */
+    rc = netlink_read(nl, NULL, 1, NULL); /* ACK */
 
     return rc;
 }
@@ -552,6 +598,13 @@ kernel_setup(int setup)
             perror("netlink_socket(0)");
             return -1;
         }
+        rc = netlink_socket(&nl_route, 0);
+        if(rc < 0) {
+            perror("netlink_socket(route)");
+            close(nl_command.sock);
+            nl_command.sock = -1;
+            return -1;
+        }
         nl_setup = 1;
 
         if(skip_kernel_setup)
@@ -580,6 +633,8 @@ kernel_setup(int setup)
 
         close(nl_command.sock);
         nl_command.sock = -1;
+        close(nl_route.sock);
+        nl_route.sock = -1;
         nl_setup = 0;
 
         if(old_if != NULL) {
@@ -620,24 +675,35 @@ kernel_setup_socket(int setup)
     int rc;
 
     if(setup) {
-        rc = netlink_socket(&nl_listen,
-                            rtnlgrp_to_mask(RTNLGRP_IPV6_ROUTE)
-                          | rtnlgrp_to_mask(RTNLGRP_IPV4_ROUTE)
-                          | rtnlgrp_to_mask(RTNLGRP_LINK)
-                          | rtnlgrp_to_mask(RTNLGRP_IPV4_IFADDR)
-                          | rtnlgrp_to_mask(RTNLGRP_IPV6_IFADDR)
+        if(nl_listen.sock < 0) {
+            rc = netlink_socket(&nl_listen,
+                                rtnlgrp_to_mask(RTNLGRP_IPV6_ROUTE)
+                              | rtnlgrp_to_mask(RTNLGRP_IPV4_ROUTE)
     /* We monitor rules, because it can be change by third parties.  For example
        a /etc/init.d/network restart on OpenWRT flush the rules. */
-                          | rtnlgrp_to_mask(RTNLGRP_IPV4_RULE)
-                          | rtnlgrp_to_mask(RTNLGRP_IPV6_RULE));
-        if(rc < 0) {
-            perror("netlink_socket(_ROUTE | _LINK | _IFADDR | _RULE)");
-            kernel_socket = -1;
-            return -1;
+                              | rtnlgrp_to_mask(RTNLGRP_IPV4_RULE)
+                              | rtnlgrp_to_mask(RTNLGRP_IPV6_RULE));
+            if(rc < 0) {
+                perror("netlink_socket(_ROUTE | _RULE)");
+                kernel_socket = -1;
+                return -1;
+            }
         }
-
         kernel_socket = nl_listen.sock;
 
+        if(nl_listen_link.sock < 0) {
+            rc = netlink_socket(&nl_listen_link,
+                                rtnlgrp_to_mask(RTNLGRP_LINK)
+                              | rtnlgrp_to_mask(RTNLGRP_IPV4_IFADDR)
+                              | rtnlgrp_to_mask(RTNLGRP_IPV6_IFADDR));
+            if(rc < 0) {
+                perror("netlink_socket(_LINK | _IFADDR)");
+                kernel_link_socket = -1;
+                return -1;
+            }
+        }
+        kernel_link_socket = nl_listen_link.sock;
+
         return 1;
 
     } else {
@@ -645,6 +711,10 @@ kernel_setup_socket(int setup)
         close(nl_listen.sock);
         nl_listen.sock = -1;
         kernel_socket = -1;
+        if(nl_listen_link.sock >= 0)
+            close(nl_listen_link.sock);
+        nl_listen_link.sock = -1;
+        kernel_link_socket = -1;
 
         return 1;
 
@@ -944,6 +1014,12 @@ kernel_has_ipv6_subtrees(void)
     return (kernel_older_than("Linux", 3, 11) == 0);
 }
 
+int
+kernel_has_link_events(void)
+{
+    return 1;
+}
+
 int
 kernel_route(int operation, int table,
              const unsigned char *dest, unsigned short plen,
@@ -968,8 +1044,8 @@ kernel_route(int operation, int table,
 
     /* if the socket has been closed after an IO error, */
     /* we try to re-open it. */
-    if(nl_command.sock < 0) {
-        rc = netlink_socket(&nl_command, 0);
+    if(nl_route.sock < 0) {
+        rc = netlink_socket(&nl_route, 0);
         if(rc < 0) {
             int olderrno = errno;
             perror("kernel_route: netlink_socket()");
@@ -1124,7 +1200,7 @@ kernel_route(int operation, int table,
     }
     buf.nh.nlmsg_len = (char*)rta + rta->rta_len - buf.raw;
 
-    return netlink_talk(&buf.nh);
+    return netlink_talk(&nl_route, &buf.nh);
 }
 
 static int
@@ -1420,6 +1496,7 @@ filter_link(struct nlmsghdr *nh, struct kernel_link *link)
     link->ifname = parse_ifname_rta(info, len);
     if(link->ifname == NULL)
         return 0;
+    link->ifindex = ifindex;
     kdebugf("filter_interfaces: link change on if %s(%d): 0x%x\n",
             link->ifname, ifindex, (unsigned)ifflags);
     return 1;
@@ -1503,21 +1580,35 @@ filter_netlink(struct nlmsghdr *nh, struct kernel_filter *filter)
 int
 kernel_callback(struct kernel_filter *filter)
 {
-    int rc;
+    int rc, lost = 0;
 
     kdebugf("\nReceived changes in kernel tables.\n");
 
-    if(nl_listen.sock < 0) {
+    if(nl_listen.sock < 0 || nl_listen_link.sock < 0) {
         rc = kernel_setup_socket(1);
         if(rc < 0) {
             perror("kernel_callback: kernel_setup_socket(1)");
-            return -1;
+            return 0;
         }
     }
-    rc = netlink_read(&nl_listen, &nl_command, 0, filter);
 
-    if(rc < 0 && nl_listen.sock < 0)
+    /* Only read the sockets that are ready, netlink_read would otherwise
+       wait for a notification. */
+    if(wait_for_fd(0, nl_listen.sock, 0) > 0) {
+        /* Ignore the notifications caused by our own route changes. */
+        rc = netlink_read(&nl_listen, &nl_route, 0, filter);
+        if(rc < 0 && errno == ENOBUFS)
+            lost |= CHANGE_ROUTE | CHANGE_RULE;
+    }
+
+    if(wait_for_fd(0, nl_listen_link.sock, 0) > 0) {
+        rc = netlink_read(&nl_listen_link, NULL, 0, filter);
+        if(rc < 0 && errno == ENOBUFS)
+            lost |= CHANGE_LINK | CHANGE_ADDR;
+    }
+
+    if(nl_listen.sock < 0 || nl_listen_link.sock < 0)
         kernel_setup_socket(1);
 
-    return 0;
+    return lost;
 }
@@ -55,6 +55,7 @@ THE SOFTWARE.
 static int get_sdl(struct sockaddr_dl *sdl, char *ifname);
 
 int export_table = -1, import_table_count = 0, import_tables[MAX_IMPORT_TABLES];
+int kernel_socket_buffer_size = 512 * 1024;
 
 int
 if_eui64(char *ifname, int ifindex, unsigned char *eui)
@@ -277,6 +278,11 @@ kernel_setup_socket(int setup)
                         &zero, sizeof(zero));
         if(rc < 0)
             goto error;
+        rc = setsockopt(kernel_socket, SOL_SOCKET, SO_RCVBUF,
+                        &kernel_socket_buffer_size,
+                        sizeof(kernel_socket_buffer_size));
+        if(rc < 0)
+            perror("setsockopt(SO_RCVBUF)");
         return 1;
     } else {
         close(kernel_socket);
@@ -396,6 +402,13 @@ kernel_has_ipv6_subtrees(void)
     return 0;
 }
 
+/* The routing socket doesn't tell us about link changes. */
+int
+kernel_has_link_events(void)
+{
+    return 0;
+}
+
 int
 kernel_route(int operation, int table,
              const unsigned char *dest, unsigned short plen,
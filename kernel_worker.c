@@ -0,0 +1,368 @@
+/*
+Copyright (c) 2007, 2008 by Juliusz Chroboczek
+Copyright (c) 2021 by Florian Wiedner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <sys/time.h>
+
+#include "babeld.h"
+#include "kernel.h"
+#include "kernel_worker.h"
+#include "trace.h"
+
+#define KERNEL_OP_STOP (-1)
+
+struct kernel_ring {
+    struct kernel_op ops[KERNEL_QUEUE_SIZE];
+    atomic_uint head;
+    atomic_uint tail;
+};
+
+/* requests is written by the main loop and read by the worker,
+   completions the other way round. */
+static struct kernel_ring requests, completions;
+
+static pthread_t worker_thread;
+static sem_t worker_sem;
+static int worker_running = 0;
+static int worker_pipe[2] = {-1, -1};
+int kernel_worker_fd = -1;
+
+/* Requests that didn't fit in the ring, in order.  Main loop only. */
+static struct kernel_op *overflow = NULL, *overflow_tail = NULL;
+
+static int
+ring_push(struct kernel_ring *ring, const struct kernel_op *op)
+{
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    if(tail - head >= KERNEL_QUEUE_SIZE)
+        return 0;
+    ring->ops[tail % KERNEL_QUEUE_SIZE] = *op;
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return 1;
+}
+
+static int
+ring_pop(struct kernel_ring *ring, struct kernel_op *op)
+{
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+    if(head == tail)
+        return 0;
+    *op = ring->ops[head % KERNEL_QUEUE_SIZE];
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return 1;
+}
+
+static void
+wake_main_loop(void)
+{
+    int rc;
+
+    do {
+        rc = write(worker_pipe[1], "", 1);
+    } while(rc < 0 && errno == EINTR);
+    /* EAGAIN means that the main loop already has a wakeup pending. */
+}
+
+static void *
+kernel_worker(void *arg)
+{
+    struct kernel_op op;
+    int rc, stop = 0, done;
+
+    while(!stop) {
+        while(sem_wait(&worker_sem) < 0 && errno == EINTR)
+            ;
+        done = 0;
+        while(ring_pop(&requests, &op)) {
+            if(op.operation == KERNEL_OP_STOP) {
+                stop = 1;
+                break;
+            }
+            rc = kernel_route(op.operation, op.table, op.dest, op.plen,
+                              op.src, op.src_plen, op.tos,
+                              op.have_pref_src ? op.pref_src : NULL,
+                              op.gate, op.ifindex, op.metric,
+                              op.newgate, op.newifindex, op.newmetric,
+                              op.newtable);
+            done++;
+            if(rc < 0 && (op.operation == ROUTE_FLUSH || errno != EEXIST)) {
+                if(op.failed == NULL)
+                    continue;
+                op.error = errno;
+            } else if(op.trace_start != 0) {
+                op.error = 0;
+                op.trace_end = trace_now();
+            } else {
+                continue;
+            }
+            while(!ring_push(&completions, &op))
+                usleep(1000);
+        }
+        /* Also lets the main loop move any overflow into the ring. */
+        if(done > 0)
+            wake_main_loop();
+    }
+    return NULL;
+}
+
+static int
+set_nonblocking(int fd)
+{
+    int rc = fcntl(fd, F_GETFL, 0);
+    if(rc < 0)
+        return -1;
+    return fcntl(fd, F_SETFL, rc | O_NONBLOCK);
+}
+
+int
+kernel_worker_start(void)
+{
+#ifdef __linux__
+    int rc;
+
+    if(worker_running)
+        return 0;
+
+    rc = pipe(worker_pipe);
+    if(rc < 0)
+        return -1;
+    if(set_nonblocking(worker_pipe[0]) < 0 ||
+       set_nonblocking(worker_pipe[1]) < 0)
+        goto fail;
+
+    rc = sem_init(&worker_sem, 0, 0);
+    if(rc < 0)
+        goto fail;
+
+    rc = pthread_create(&worker_thread, NULL, kernel_worker, NULL);
+    if(rc != 0) {
+        sem_destroy(&worker_sem);
+        errno = rc;
+        goto fail;
+    }
+
+    worker_running = 1;
+    kernel_worker_fd = worker_pipe[0];
+    return 1;
+
+ fail:
+    close(worker_pipe[0]);
+    close(worker_pipe[1]);
+    worker_pipe[0] = worker_pipe[1] = -1;
+    return -1;
+#else
+    /* On other systems route changes go through the routing socket that
+       we also read from, so they stay in the main loop. */
+    return 0;
+#endif
+}
+
+static void
+drain_completions(void)
+{
+    struct kernel_op op;
+
+    while(ring_pop(&completions, &op)) {
+        if(op.error != 0)
+            op.failed(&op, op.error);
+        else
+            trace_record(TRACE_KERNEL, op.tos[0],
+                         op.trace_start, op.trace_end);
+    }
+}
+
+/* The worker may itself be waiting for room in the completion ring. */
+static void
+wait_for_worker(void)
+{
+    drain_completions();
+    usleep(1000);
+}
+
+static void
+flush_overflow(void)
+{
+    struct kernel_op *op;
+
+    while(overflow != NULL && ring_push(&requests, overflow)) {
+        op = overflow;
+        overflow = op->next;
+        free(op);
+        sem_post(&worker_sem);
+    }
+    if(overflow == NULL)
+        overflow_tail = NULL;
+}
+
+static void
+submit(const struct kernel_op *op)
+{
+    struct kernel_op *copy;
+
+    if(overflow == NULL && ring_push(&requests, op)) {
+        sem_post(&worker_sem);
+        return;
+    }
+
+    copy = malloc(sizeof(struct kernel_op));
+    if(copy == NULL) {
+        /* Changes must be applied in order, wait for the worker. */
+        perror("malloc(kernel_op)");
+        while(overflow != NULL) {
+            flush_overflow();
+            if(overflow != NULL)
+                wait_for_worker();
+        }
+        while(!ring_push(&requests, op))
+            wait_for_worker();
+        sem_post(&worker_sem);
+        return;
+    }
+
+    *copy = *op;
+    copy->next = NULL;
+    if(overflow_tail)
+        overflow_tail->next = copy;
+    else
+        overflow = copy;
+    overflow_tail = copy;
+}
+
+/* Returns 0 if the change was queued, otherwise the result of
+   kernel_route, in which case failed is not called. */
+int
+kernel_route_async(int operation, int table,
+                   const unsigned char *dest, unsigned short plen,
+                   const unsigned char *src, unsigned short src_plen,
+                   const unsigned char *tos,
+                   const unsigned char *pref_src,
+                   const unsigned char *gate, int ifindex,
+                   unsigned int metric,
+                   const unsigned char *newgate, int newifindex,
+                   unsigned int newmetric, int newtable,
+                   void (*failed)(const struct kernel_op *op, int error),
+                   unsigned int cookie)
+{
+    struct kernel_op op;
+
+    if(!worker_running) {
+        int rc = kernel_route(operation, table, dest, plen, src, src_plen,
+                              tos, pref_src, gate, ifindex, metric,
+                              newgate, newifindex, newmetric, newtable);
+        if(rc >= 0)
+            trace_stage(TRACE_KERNEL, tos);
+        return rc;
+    }
+
+    memset(&op, 0, sizeof(op));
+    op.operation = operation;
+    op.table = table;
+    memcpy(op.dest, dest, 16);
+    op.plen = plen;
+    memcpy(op.src, src, 16);
+    op.src_plen = src_plen;
+    op.tos[0] = tos[0];
+    if(pref_src) {
+        op.have_pref_src = 1;
+        memcpy(op.pref_src, pref_src, 16);
+    }
+    memcpy(op.gate, gate, 16);
+    op.ifindex = ifindex;
+    op.metric = metric;
+    if(newgate)
+        memcpy(op.newgate, newgate, 16);
+    op.newifindex = newifindex;
+    op.newmetric = newmetric;
+    op.newtable = newtable;
+    op.failed = failed;
+    op.cookie = cookie;
+    op.trace_start = trace_start;
+
+    submit(&op);
+    return 0;
+}
+
+void
+kernel_worker_poll(void)
+{
+    char buf[64];
+    int rc;
+
+    if(!worker_running)
+        return;
+
+    do {
+        rc = read(worker_pipe[0], buf, sizeof(buf));
+    } while(rc > 0 || (rc < 0 && errno == EINTR));
+
+    drain_completions();
+    flush_overflow();
+}
+
+/* Waits until all queued changes have been applied. */
+void
+kernel_worker_stop(void)
+{
+    struct kernel_op op;
+
+    if(!worker_running)
+        return;
+
+    while(overflow != NULL) {
+        flush_overflow();
+        if(overflow != NULL)
+            wait_for_worker();
+    }
+
+    memset(&op, 0, sizeof(op));
+    op.operation = KERNEL_OP_STOP;
+    while(!ring_push(&requests, &op))
+        wait_for_worker();
+    sem_post(&worker_sem);
+    /* Don't join while the worker might still be blocked on completions. */
+    while(atomic_load_explicit(&requests.head, memory_order_acquire) !=
+          atomic_load_explicit(&requests.tail, memory_order_acquire))
+        wait_for_worker();
+    pthread_join(worker_thread, NULL);
+    sem_destroy(&worker_sem);
+
+    drain_completions();
+
+    close(worker_pipe[0]);
+    close(worker_pipe[1]);
+    worker_pipe[0] = worker_pipe[1] = -1;
+    kernel_worker_fd = -1;
+    worker_running = 0;
+}
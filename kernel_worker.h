@@ -0,0 +1,75 @@
+/*
+Copyright (c) 2007, 2008 by Juliusz Chroboczek
+Copyright (c) 2021 by Florian Wiedner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* Route changes are handed over to a worker thread through a
+   single-producer, single-consumer ring, so that the main loop never
+   waits for the kernel to acknowledge them.  Failures come back through
+   a second ring, which the main loop drains when kernel_worker_fd
+   becomes readable. */
+
+#define KERNEL_QUEUE_SIZE 1024
+
+struct kernel_op {
+    int operation;
+    int table;
+    unsigned char dest[16];
+    unsigned short plen;
+    unsigned char src[16];
+    unsigned short src_plen;
+    unsigned char tos[1];
+    char have_pref_src;
+    unsigned char pref_src[16];
+    unsigned char gate[16];
+    int ifindex;
+    unsigned int metric;
+    unsigned char newgate[16];
+    int newifindex;
+    unsigned int newmetric;
+    int newtable;
+    /* Called from the main loop with the errno of a failed change. */
+    void (*failed)(const struct kernel_op *op, int error);
+    /* Opaque to the worker, for failed to recognise the change. */
+    unsigned int cookie;
+    int error;
+    /* Receive time of the update that caused this change, and time at
+       which the kernel acknowledged it, for latency tracing. */
+    unsigned long long trace_start, trace_end;
+    struct kernel_op *next;
+};
+
+extern int kernel_worker_fd;
+
+int kernel_worker_start(void);
+void kernel_worker_stop(void);
+void kernel_worker_poll(void);
+int kernel_route_async(int operation, int table,
+                       const unsigned char *dest, unsigned short plen,
+                       const unsigned char *src, unsigned short src_plen,
+                       const unsigned char *tos,
+                       const unsigned char *pref_src,
+                       const unsigned char *gate, int ifindex,
+                       unsigned int metric,
+                       const unsigned char *newgate, int newifindex,
+                       unsigned int newmetric, int newtable,
+                       void (*failed)(const struct kernel_op *op, int error),
+                       unsigned int cookie);
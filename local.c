@@ -31,6 +31,7 @@ THE SOFTWARE.
 #include <arpa/inet.h>
 
 #include "babeld.h"
+#include "net.h"
 #include "interface.h"
 #include "source.h"
 #include "neighbour.h"
@@ -40,6 +41,7 @@ THE SOFTWARE.
 #include "util.h"
 #include "configuration.h"
 #include "local.h"
+#include "trace.h"
 #include "version.h"
 
 int local_server_socket = -1;
@@ -317,6 +319,60 @@ local_notify_all_1(struct local_socket *s)
     return;
 }
 
+/* Receive and pacing counters, followed by the convergence latency
+   histograms. */
+static int
+local_stats_1(struct local_socket *s)
+{
+    char buf[512];
+    struct interface *ifp;
+    int rc, stage, tos;
+
+    rc = snprintf(buf, 512,
+                  "stats receive packets %lu batches %lu max-batch %d "
+                  "drops %u\n",
+                  receive_stats.packets, receive_stats.batches,
+                  receive_stats.max_batch, receive_stats.drops);
+    if(rc < 0 || rc >= 512)
+        return -1;
+    rc = write_timeout(s->fd, buf, rc);
+    if(rc < 0)
+        return -1;
+
+    FOR_ALL_INTERFACES(ifp) {
+        struct pacing *p = &ifp->pacing;
+        if(p->rate == 0 && p->packet_rate == 0)
+            continue;
+        rc = snprintf(buf, 512,
+                      "stats pacing %s rate %u packet-rate %u queued %d "
+                      "deferred %lu mean-deferral-ms %lu "
+                      "max-deferral-ms %u overflows %lu\n",
+                      ifp->name, p->rate, p->packet_rate, p->len,
+                      p->deferred,
+                      p->deferred > 0 ? p->deferral_msecs / p->deferred : 0,
+                      p->max_deferral_msecs, p->overflows);
+        if(rc < 0 || rc >= 512)
+            return -1;
+        rc = write_timeout(s->fd, buf, rc);
+        if(rc < 0)
+            return -1;
+    }
+
+    for(stage = 0; stage < TRACE_STAGES; stage++) {
+        for(tos = 0; tos < 256; tos++) {
+            rc = trace_format(stage, tos, buf, 512);
+            if(rc < 0)
+                return -1;
+            if(rc == 0)
+                continue;
+            rc = write_timeout(s->fd, buf, rc);
+            if(rc < 0)
+                return -1;
+        }
+    }
+    return 0;
+}
+
 int
 local_read(struct local_socket *s)
 {
@@ -364,6 +420,18 @@ local_read(struct local_socket *s)
         case CONFIG_ACTION_UNMONITOR:
             s->monitor = 0;
             break;
+        case CONFIG_ACTION_STATS:
+            rc = local_stats_1(s);
+            if(rc < 0)
+                goto fail;
+            break;
+        case CONFIG_ACTION_LOOKUP:
+            rc = write_timeout(s->fd, message, strlen(message));
+            if(rc >= 0)
+                rc = write_timeout(s->fd, "\n", 1);
+            if(rc < 0)
+                goto fail;
+            break;
         case CONFIG_ACTION_NO:
             snprintf(reply, sizeof(reply), "no%s%s\n",
                      message ? " " : "", message ? message : "");
@@ -0,0 +1,233 @@
+/*
+Copyright (c) 2007, 2008 by Juliusz Chroboczek
+Copyright (c) 2021 by Florian Wiedner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+
+#include "babeld.h"
+#include "util.h"
+#include "lookup.h"
+
+static struct lookup_entry **lookup_table = NULL;
+static int lookup_buckets = 0, num_lookup_entries = 0;
+
+/* Number of entries of each destination prefix length, so that a lookup
+   only probes the lengths that are in use. */
+static int plen_count[129];
+
+static unsigned int
+lookup_hash(const unsigned char *prefix, unsigned char plen)
+{
+    unsigned int h = 2166136261U;
+    int i;
+
+    for(i = 0; i < 16; i++)
+        h = (h ^ prefix[i]) * 16777619U;
+    h = (h ^ plen) * 16777619U;
+    return h;
+}
+
+static int
+resize_lookup_table(int buckets)
+{
+    struct lookup_entry **new_table;
+    struct lookup_entry *entry, *next;
+    int i;
+
+    new_table = calloc(buckets, sizeof(struct lookup_entry*));
+    if(new_table == NULL)
+        return -1;
+
+    for(i = 0; i < lookup_buckets; i++) {
+        for(entry = lookup_table[i]; entry; entry = next) {
+            unsigned int b =
+                lookup_hash(entry->prefix, entry->plen) & (buckets - 1);
+            next = entry->next;
+            entry->next = new_table[b];
+            new_table[b] = entry;
+        }
+    }
+
+    free(lookup_table);
+    lookup_table = new_table;
+    lookup_buckets = buckets;
+    return 1;
+}
+
+static int
+entry_match(const struct lookup_entry *entry,
+            const unsigned char *prefix, unsigned char plen)
+{
+    return entry->plen == plen && memcmp(entry->prefix, prefix, 16) == 0;
+}
+
+/* Route is the installed route, or NULL for an exported route. */
+int
+add_lookup_entry(const unsigned char *prefix, unsigned char plen,
+                 const unsigned char *src_prefix, unsigned char src_plen,
+                 const unsigned char *tos, struct babel_route *route)
+{
+    struct lookup_entry *entry;
+    unsigned int b;
+
+    if(num_lookup_entries >= lookup_buckets) {
+        resize_lookup_table(lookup_buckets < 1 ? 64 : 2 * lookup_buckets);
+        if(lookup_buckets < 1)
+            return -1;
+    }
+
+    entry = malloc(sizeof(struct lookup_entry));
+    if(entry == NULL) {
+        perror("malloc(lookup_entry)");
+        return -1;
+    }
+
+    memcpy(entry->prefix, prefix, 16);
+    entry->plen = plen;
+    memcpy(entry->src_prefix, src_prefix, 16);
+    entry->src_plen = src_plen;
+    entry->tos[0] = tos[0];
+    entry->route = route;
+
+    b = lookup_hash(prefix, plen) & (lookup_buckets - 1);
+    entry->next = lookup_table[b];
+    lookup_table[b] = entry;
+    num_lookup_entries++;
+    plen_count[plen]++;
+    return 1;
+}
+
+void
+flush_lookup_entry(const unsigned char *prefix, unsigned char plen,
+                   const unsigned char *src_prefix, unsigned char src_plen,
+                   const unsigned char *tos, struct babel_route *route)
+{
+    struct lookup_entry **p, *entry;
+
+    if(lookup_buckets < 1)
+        return;
+
+    p = &lookup_table[lookup_hash(prefix, plen) & (lookup_buckets - 1)];
+    while(*p) {
+        entry = *p;
+        if(entry->route == route && entry_match(entry, prefix, plen) &&
+           entry->src_plen == src_plen &&
+           memcmp(entry->src_prefix, src_prefix, 16) == 0 &&
+           entry->tos[0] == tos[0]) {
+            *p = entry->next;
+            free(entry);
+            num_lookup_entries--;
+            plen_count[plen]--;
+            return;
+        }
+        p = &entry->next;
+    }
+}
+
+/* Enumerates the entries for a given destination, in no particular
+   order. */
+struct lookup_entry *
+first_lookup_entry(const unsigned char *prefix, unsigned char plen)
+{
+    struct lookup_entry *entry;
+
+    if(lookup_buckets < 1 || plen_count[plen] == 0)
+        return NULL;
+
+    entry = lookup_table[lookup_hash(prefix, plen) & (lookup_buckets - 1)];
+    while(entry && !entry_match(entry, prefix, plen))
+        entry = entry->next;
+    return entry;
+}
+
+struct lookup_entry *
+next_lookup_entry(struct lookup_entry *entry)
+{
+    struct lookup_entry *next = entry->next;
+
+    while(next && !entry_match(next, entry->prefix, entry->plen))
+        next = next->next;
+    return next;
+}
+
+/* Returns the entry that would be used for a packet to address.  The
+   longest destination prefix wins.  Within a destination, the longest
+   source prefix containing src_address wins, a route without a source
+   prefix matching any source.  Then a route for the packet's DSCP class
+   wins over one for the default class; a route for another class never
+   matches, and without a class only default-class routes match.  An
+   exported route wins a remaining tie, since we are its origin.
+   Src_address and tos may be NULL. */
+struct lookup_entry *
+lookup_address(const unsigned char *address, const unsigned char *src_address,
+               const unsigned char *tos)
+{
+    unsigned char prefix[16];
+    int plen;
+    int min_plen = v4mapped(address) ? 96 : 0;
+
+    for(plen = 128; plen >= min_plen; plen--) {
+        struct lookup_entry *entry, *best = NULL;
+        int best_src_plen = -1, best_exact = 0;
+
+        if(plen_count[plen] == 0)
+            continue;
+
+        normalize_prefix(prefix, address, plen);
+        for(entry = first_lookup_entry(prefix, plen); entry;
+            entry = next_lookup_entry(entry)) {
+            int src_plen, exact;
+
+            if(is_default(entry->src_prefix, entry->src_plen))
+                src_plen = 0;
+            else if(src_address &&
+                    in_prefix(src_address, entry->src_prefix,
+                              entry->src_plen))
+                src_plen = entry->src_plen;
+            else
+                continue;
+
+            if(tos && entry->tos[0] == tos[0])
+                exact = 1;
+            else if(is_default_tos(entry->tos))
+                exact = 0;
+            else
+                continue;
+
+            if(src_plen > best_src_plen ||
+               (src_plen == best_src_plen &&
+                (exact > best_exact ||
+                 (exact == best_exact && entry->route == NULL)))) {
+                best = entry;
+                best_src_plen = src_plen;
+                best_exact = exact;
+            }
+        }
+        if(best)
+            return best;
+    }
+    return NULL;
+}
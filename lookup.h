@@ -0,0 +1,51 @@
+/*
+Copyright (c) 2007, 2008 by Juliusz Chroboczek
+Copyright (c) 2021 by Florian Wiedner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* Longest-prefix match over the installed and the exported routes.
+   Entries are hashed by destination only, so that all the entries for a
+   destination share a bucket, and a lookup probes one bucket for every
+   prefix length that is in use. */
+
+struct lookup_entry {
+    unsigned char prefix[16];
+    unsigned char plen;
+    unsigned char src_prefix[16];
+    unsigned char src_plen;
+    unsigned char tos[1];
+    struct babel_route *route;  /* NULL for an exported route */
+    struct lookup_entry *next;
+};
+
+int add_lookup_entry(const unsigned char *prefix, unsigned char plen,
+                     const unsigned char *src_prefix, unsigned char src_plen,
+                     const unsigned char *tos, struct babel_route *route);
+void flush_lookup_entry(const unsigned char *prefix, unsigned char plen,
+                        const unsigned char *src_prefix,
+                        unsigned char src_plen, const unsigned char *tos,
+                        struct babel_route *route);
+struct lookup_entry *first_lookup_entry(const unsigned char *prefix,
+                                        unsigned char plen);
+struct lookup_entry *next_lookup_entry(struct lookup_entry *entry);
+struct lookup_entry *lookup_address(const unsigned char *address,
+                                    const unsigned char *src_address,
+                                    const unsigned char *tos);
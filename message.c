@@ -40,9 +40,12 @@ THE SOFTWARE.
 #include "kernel.h"
 #include "xroute.h"
 #include "resend.h"
+#include "timer.h"
 #include "message.h"
 #include "configuration.h"
 #include "hmac.h"
+#include "hmac_pool.h"
+#include "trace.h"
 
 unsigned char packet_header[4] = {42, 2};
 
@@ -600,7 +603,7 @@ preparse_packet(const unsigned char *from, struct interface *ifp,
 void
 parse_packet(const unsigned char *from, struct interface *ifp,
              const unsigned char *packet, int packetlen,
-             const unsigned char *to)
+             const unsigned char *to, int hmac_rc)
 {
     int i;
     const unsigned char *message;
@@ -648,7 +651,9 @@ parse_packet(const unsigned char *from, struct interface *ifp,
     }
 
     if(ifp->key != NULL) {
-        int rc = check_hmac(packet, packetlen, bodylen, from, to, ifp);
+        int rc = hmac_rc;
+        if(rc == HMAC_UNCHECKED)
+            rc = check_hmac(packet, packetlen, bodylen, from, to, ifp);
         if(rc <= 0) {
             if(rc < 0)
                 debugf("Received unsigned packet.\n");
@@ -949,10 +954,12 @@ parse_packet(const unsigned char *from, struct interface *ifp,
                     goto done;
             }
 
+            trace_begin(tos);
             update_route(have_router_id ? router_id : NULL,
                          prefix, plen, src_prefix, src_plen, tos, seqno,
                          metric, interval, neigh, nh,
                          channels, channels_len);
+            trace_end();
         } else if(type == MESSAGE_REQUEST) {
             unsigned char prefix[16], src_prefix[16], plen, src_plen, tos[1];
             tos[0] = 0;
@@ -997,7 +1004,11 @@ parse_packet(const unsigned char *from, struct interface *ifp,
                    shortly after we sent a full update. */
                 if(neigh->ifp->last_update_time <
                    now.tv_sec - MAX(neigh->ifp->hello_interval / 100, 1)) {
-                    send_update(neigh->ifp, 0, NULL, 0, NULL, 0, NULL);
+                    if(!is_default_tos(tos))
+                        /* Wildcard request restricted to a DSCP class. */
+                        send_update_tos(neigh->ifp, tos);
+                    else
+                        send_update(neigh->ifp, 0, NULL, 0, NULL, 0, NULL);
                 }
             } else {
                 debugf("Received request for dst %s%s%s from %s on %s with TOS %s.\n",
@@ -1127,8 +1138,163 @@ fill_rtt_message(struct buffered *buf, struct interface *ifp)
     return 0;
 }
 
+/* While batching is enabled, flushbuf copies packets to the send queue,
+   and they are sent together by end_send_batch.  This saves system calls
+   on nodes with many interfaces or unicast neighbours. */
+
+static struct {
+    unsigned char *bufs[SEND_BATCH_MAX];
+    int sizes[SEND_BATCH_MAX];
+    int lens[SEND_BATCH_MAX];
+    struct sockaddr_in6 sins[SEND_BATCH_MAX];
+    int len;
+} send_queue;
+static int send_batching = 0;
+
+static void
+flush_send_queue(void)
+{
+    if(send_queue.len > 0) {
+        debugf("  (sending %d queued packets)\n", send_queue.len);
+        babel_send_batch(protocol_socket, send_queue.bufs, send_queue.lens,
+                         send_queue.sins, send_queue.len);
+    }
+    send_queue.len = 0;
+}
+
+/* Returns -1 if the packet could not be queued. */
+static int
+queue_packet(const unsigned char *header, int headerlen,
+             const unsigned char *body, int bodylen,
+             const struct sockaddr_in6 *sin6)
+{
+    int i, len = headerlen + bodylen;
+
+    if(send_queue.len >= SEND_BATCH_MAX)
+        flush_send_queue();
+
+    i = send_queue.len;
+    if(send_queue.sizes[i] < len) {
+        unsigned char *new_buf = realloc(send_queue.bufs[i], len);
+        if(new_buf == NULL)
+            return -1;
+        send_queue.bufs[i] = new_buf;
+        send_queue.sizes[i] = len;
+    }
+
+    memcpy(send_queue.bufs[i], header, headerlen);
+    memcpy(send_queue.bufs[i] + headerlen, body, bodylen);
+    send_queue.lens[i] = len;
+    send_queue.sins[i] = *sin6;
+    send_queue.len++;
+    return 0;
+}
+
 void
-flushbuf(struct buffered *buf, struct interface *ifp)
+begin_send_batch(void)
+{
+    send_batching = 1;
+}
+
+void
+end_send_batch(void)
+{
+    send_batching = 0;
+    flush_send_queue();
+}
+
+/* On unicast interfaces, updates are encoded once into unicast_updates
+   and the resulting TLVs are then copied to every neighbour's buffer.
+   Every chunk starts with empty compression state, so that it can be
+   appended to a buffer regardless of what that buffer already holds. */
+
+static struct buffered unicast_updates;
+static struct interface *unicast_updates_ifp = NULL;
+
+static void schedule_flush(struct buffered *buf);
+static void ensure_space(struct buffered *buf, struct interface *ifp,
+                         int space);
+
+static int
+start_unicast_updates(struct interface *ifp)
+{
+    if(unicast_updates.size < ifp->buf.size) {
+        unsigned char *new_buf = realloc(unicast_updates.buf, ifp->buf.size);
+        if(new_buf == NULL) {
+            perror("realloc(unicast_updates)");
+            return -1;
+        }
+        unicast_updates.buf = new_buf;
+    }
+    /* Never use more than a neighbour buffer can hold. */
+    unicast_updates.size = ifp->buf.size;
+    unicast_updates.len = 0;
+    unicast_updates.hello = -1;
+    unicast_updates.priority = 0;
+    unicast_updates.have_id = 0;
+    unicast_updates.have_nh = 0;
+    unicast_updates.have_prefix = 0;
+    unicast_updates_ifp = ifp;
+    return 1;
+}
+
+static void
+replicate_unicast_updates(struct interface *ifp)
+{
+    struct buffered *ub = &unicast_updates;
+    struct neighbour *neigh;
+
+    if(ub->len > 0) {
+        FOR_IFP_NEIGHBOURS(ifp, neigh) {
+            struct buffered *buf = &neigh->buf;
+            ensure_space(buf, ifp, ub->len);
+            memcpy(buf->buf + buf->len, ub->buf, ub->len);
+            buf->len += ub->len;
+            buf->have_id = ub->have_id;
+            memcpy(buf->id, ub->id, 8);
+            buf->have_nh = ub->have_nh;
+            memcpy(buf->nh, ub->nh, 4);
+            buf->have_prefix = ub->have_prefix;
+            memcpy(buf->prefix, ub->prefix, 16);
+            buf->priority |= ub->priority;
+            schedule_flush(buf);
+        }
+    }
+    ub->len = 0;
+    ub->priority = 0;
+    ub->have_id = 0;
+    ub->have_nh = 0;
+    ub->have_prefix = 0;
+}
+
+static void
+finish_unicast_updates(struct interface *ifp)
+{
+    replicate_unicast_updates(ifp);
+    unicast_updates_ifp = NULL;
+}
+
+static void flush_requests(struct buffered *buf, struct interface *ifp);
+static int requests_pending(struct buffered *buf);
+
+static void
+clear_buffer(struct buffered *buf)
+{
+    VALGRIND_MAKE_MEM_UNDEFINED(buf->buf, buf->size);
+    buf->len = 0;
+    buf->hello = -1;
+    buf->link_len = 0;
+    buf->priority = 0;
+    buf->have_id = 0;
+    buf->have_nh = 0;
+    buf->have_prefix = 0;
+    buf->timeout.tv_sec = 0;
+    buf->timeout.tv_usec = 0;
+    buf->trace_start = 0;
+}
+
+static void
+send_buffered(struct buffered *buf, struct interface *ifp)
 {
     int rc;
     int end = buf->len;
@@ -1148,22 +1314,261 @@ flushbuf(struct buffered *buf, struct interface *ifp)
                 return;
             }
         }
-        rc = babel_send(protocol_socket,
-                        packet_header, sizeof(packet_header),
-                        buf->buf, end,
-                        (struct sockaddr*)&buf->sin6,
-                        sizeof(buf->sin6));
-        if(rc < 0)
-            perror("send");
+        rc = -1;
+        if(send_batching) {
+            rc = queue_packet(packet_header, sizeof(packet_header),
+                              buf->buf, end, &buf->sin6);
+            /* Don't overtake the queued packets, which carry lower PCs. */
+            if(rc < 0)
+                flush_send_queue();
+        }
+        if(rc < 0) {
+            rc = babel_send(protocol_socket,
+                            packet_header, sizeof(packet_header),
+                            buf->buf, end,
+                            (struct sockaddr*)&buf->sin6,
+                            sizeof(buf->sin6));
+            if(rc < 0)
+                perror("send");
+        }
+        trace_record(TRACE_SENT, buf->trace_tos, buf->trace_start,
+                     trace_now());
+    }
+    clear_buffer(buf);
+}
+
+/* Pacing.  When a rate limit is configured on an interface, routing TLVs
+   are deferred until the token buckets allow them to be sent.
+   Link-maintenance TLVs are never delayed, and neither are retractions
+   unless older packets are waiting, but they still consume tokens. */
+
+static int
+pacing_enabled(struct interface *ifp)
+{
+    return ifp->pacing.rate > 0 || ifp->pacing.packet_rate > 0;
+}
+
+static void
+refill_pacing(struct interface *ifp)
+{
+    struct pacing *p = &ifp->pacing;
+    long long max_bytes = (long long)MAX(p->rate, ifp->buf.size) * 1000;
+    long long max_packets = (long long)MAX(p->packet_rate, 1) * 1000;
+    unsigned msecs;
+
+    if(p->last.tv_sec == 0) {
+        p->bytes = max_bytes;
+        p->packets = max_packets;
+        p->last = now;
+        return;
+    }
+
+    msecs = timeval_minus_msec(&now, &p->last);
+    if(msecs == 0)
+        return;
+    p->bytes = MIN(p->bytes + (long long)p->rate * msecs, max_bytes);
+    p->packets = MIN(p->packets + (long long)p->packet_rate * msecs,
+                     max_packets);
+    p->last = now;
+}
+
+static int
+pacing_allows(struct interface *ifp, int len)
+{
+    struct pacing *p = &ifp->pacing;
+    return (p->rate == 0 || p->bytes >= (long long)len * 1000) &&
+        (p->packet_rate == 0 || p->packets >= 1000);
+}
+
+static void
+pacing_charge(struct interface *ifp, int len)
+{
+    struct pacing *p = &ifp->pacing;
+    long long max_bytes = (long long)MAX(p->rate, ifp->buf.size) * 1000;
+    long long max_packets = (long long)MAX(p->packet_rate, 1) * 1000;
+
+    /* Priority traffic may overdraw the buckets, but not indefinitely. */
+    if(p->rate > 0)
+        p->bytes = MAX(p->bytes - (long long)len * 1000, -max_bytes);
+    if(p->packet_rate > 0)
+        p->packets = MAX(p->packets - 1000, -max_packets);
+}
+
+static void
+schedule_pacing(struct interface *ifp)
+{
+    struct pacing *p = &ifp->pacing;
+    long long msecs = 1;
+
+    if(p->len == 0) {
+        p->timeout.tv_sec = 0;
+        p->timeout.tv_usec = 0;
+        return;
+    }
+
+    if(p->rate > 0) {
+        long long need = (long long)p->queue[p->head].len * 1000 - p->bytes;
+        if(need > 0)
+            msecs = MAX(msecs, (need + p->rate - 1) / p->rate);
+    }
+    if(p->packet_rate > 0) {
+        long long need = 1000 - p->packets;
+        if(need > 0)
+            msecs = MAX(msecs, (need + p->packet_rate - 1) / p->packet_rate);
+    }
+    timeval_add_msec(&p->timeout, &now, MIN(msecs, 60 * 1000));
+    schedule_timer(&p->timeout, TIMER_PACING, ifp);
+}
+
+/* Defers the routing TLVs of a buffer, which follow the link-maintenance
+   ones.  Returns -1 if the packet could not be deferred. */
+static int
+defer_packet(struct buffered *buf, struct interface *ifp)
+{
+    struct pacing *p = &ifp->pacing;
+    struct paced_packet *pp;
+
+    if(p->len >= PACING_QUEUE_MAX)
+        return -1;
+
+    if(p->queue == NULL) {
+        p->queue = calloc(PACING_QUEUE_MAX, sizeof(struct paced_packet));
+        if(p->queue == NULL) {
+            perror("calloc(pacing)");
+            return -1;
+        }
+    }
+
+    pp = &p->queue[(p->head + p->len) % PACING_QUEUE_MAX];
+    if(pp->size < buf->size) {
+        unsigned char *new_buf = realloc(pp->buf, buf->size);
+        if(new_buf == NULL)
+            return -1;
+        pp->buf = new_buf;
+        pp->size = buf->size;
+    }
+    memcpy(pp->buf, buf->buf + buf->link_len, buf->len - buf->link_len);
+    pp->len = buf->len - buf->link_len;
+    pp->sin6 = buf->sin6;
+    pp->time = now;
+    pp->trace_start = buf->trace_start;
+    pp->trace_tos = buf->trace_tos;
+    p->len++;
+    p->deferred++;
+
+    if(p->len == 1)
+        schedule_pacing(ifp);
+    return 1;
+}
+
+static void
+send_paced_packet(struct interface *ifp)
+{
+    struct pacing *p = &ifp->pacing;
+    struct paced_packet *pp = &p->queue[p->head];
+    struct buffered buf;
+    unsigned msecs;
+
+    pacing_charge(ifp, pp->len);
+    msecs = timeval_minus_msec(&now, &pp->time);
+    p->deferral_msecs += msecs;
+    p->max_deferral_msecs = MAX(p->max_deferral_msecs, msecs);
+
+    memset(&buf, 0, sizeof(buf));
+    buf.sin6 = pp->sin6;
+    buf.buf = pp->buf;
+    buf.len = pp->len;
+    buf.size = pp->size;
+    buf.hello = -1;
+    buf.trace_start = pp->trace_start;
+    buf.trace_tos = pp->trace_tos;
+    send_buffered(&buf, ifp);
+
+    p->head = (p->head + 1) % PACING_QUEUE_MAX;
+    p->len--;
+}
+
+void
+send_paced_packets(struct interface *ifp)
+{
+    struct pacing *p = &ifp->pacing;
+
+    refill_pacing(ifp);
+    while(p->len > 0 && pacing_allows(ifp, p->queue[p->head].len))
+        send_paced_packet(ifp);
+    schedule_pacing(ifp);
+}
+
+void
+discard_paced_packets(struct interface *ifp)
+{
+    struct pacing *p = &ifp->pacing;
+    int i;
+
+    if(p->queue != NULL) {
+        for(i = 0; i < PACING_QUEUE_MAX; i++)
+            free(p->queue[i].buf);
+        free(p->queue);
+    }
+    p->queue = NULL;
+    p->head = p->len = 0;
+    p->timeout.tv_sec = 0;
+    p->timeout.tv_usec = 0;
+}
+
+static void
+send_buffer(struct buffered *buf, struct interface *ifp)
+{
+    if(buf->len > 0 && pacing_enabled(ifp)) {
+        refill_pacing(ifp);
+        /* Routing TLVs never overtake packets that are already waiting,
+           lest a retraction arrive before an older update for the same
+           prefix; retractions may only overdraw the buckets when nothing
+           is waiting.  Link-maintenance TLVs are split off and sent
+           right away. */
+        if(buf->len > buf->link_len &&
+           (ifp->pacing.len > 0 ||
+            (!buf->priority && !pacing_allows(ifp, buf->len)))) {
+            if(defer_packet(buf, ifp) >= 0) {
+                buf->len = buf->link_len;
+                buf->trace_start = 0;
+                if(buf->len == 0) {
+                    clear_buffer(buf);
+                    return;
+                }
+            } else {
+                /* Keep the order, at the cost of a burst. */
+                ifp->pacing.overflows++;
+                while(ifp->pacing.len > 0)
+                    send_paced_packet(ifp);
+                schedule_pacing(ifp);
+            }
+        }
+        pacing_charge(ifp, buf->len);
+    }
+
+    send_buffered(buf, ifp);
+}
+
+void
+flushbuf(struct buffered *buf, struct interface *ifp)
+{
+    if(buf == &unicast_updates) {
+        replicate_unicast_updates(ifp);
+        return;
+    }
+
+    flush_requests(buf, ifp);
+    send_buffer(buf, ifp);
+}
+
+static void
+trace_buffer(struct buffered *buf, unsigned long long start, unsigned char tos)
+{
+    if(start != 0 && (buf->trace_start == 0 || start < buf->trace_start)) {
+        buf->trace_start = start;
+        buf->trace_tos = tos;
     }
-    VALGRIND_MAKE_MEM_UNDEFINED(buf->buf, buf->size);
-    buf->len = 0;
-    buf->hello = -1;
-    buf->have_id = 0;
-    buf->have_nh = 0;
-    buf->have_prefix = 0;
-    buf->timeout.tv_sec = 0;
-    buf->timeout.tv_usec = 0;
 }
 
 static void
@@ -1173,6 +1578,7 @@ schedule_flush_ms(struct buffered *buf, int msecs)
        timeval_minus_msec(&buf->timeout, &now) < msecs)
         return;
     set_timeout(&buf->timeout, msecs);
+    schedule_timer(&buf->timeout, buf->timer_type, buf->timer_owner);
 }
 
 static void
@@ -1187,23 +1593,60 @@ schedule_flush_now(struct buffered *buf)
     schedule_flush_ms(buf, roughly(10));
 }
 
+static int
+link_message(int type)
+{
+    switch(type) {
+    case MESSAGE_ACK:
+    case MESSAGE_HELLO:
+    case MESSAGE_IHU:
+    case MESSAGE_CHALLENGE_REQUEST:
+    case MESSAGE_CHALLENGE_REPLY:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/* Routing TLVs leave LINK_SPACE bytes free at the end of every buffer,
+   so that a Hello or an IHU never has to wait for a buffer full of
+   updates to be flushed. */
 static void
-ensure_space(struct buffered *buf, struct interface *ifp, int space)
+ensure_link_space(struct buffered *buf, struct interface *ifp, int space)
 {
     if(ifp->key != NULL)
         space += MAX_HMAC_SPACE + 6 + INDEX_LEN;
-    if(buf->size - buf->len < space)
-        flushbuf(buf, ifp);
+    if(buf->size - buf->len < space) {
+        struct timeval deadline = buf->timeout;
+        if(buf == &unicast_updates || !requests_pending(buf)) {
+            flushbuf(buf, ifp);
+            return;
+        }
+        /* Pending requests stay due at the same time, which gives them
+           a chance to be coalesced while updates keep filling the
+           buffer. */
+        send_buffer(buf, ifp);
+        if(deadline.tv_sec != 0)
+            schedule_flush_ms(buf,
+                              MAX(timeval_minus_msec(&deadline, &now), 0));
+        else
+            schedule_flush(buf);
+    }
+}
+
+static void
+ensure_space(struct buffered *buf, struct interface *ifp, int space)
+{
+    ensure_link_space(buf, ifp, space + LINK_SPACE);
 }
 
 static void
 start_message(struct buffered *buf, struct interface *ifp, int type, int len)
 {
-    int space = ifp->key == NULL
-        ? len + 2
-        : len + 2 + MAX_HMAC_SPACE + 6 + INDEX_LEN;
-    if(buf->size - buf->len < space)
-        flushbuf(buf, ifp);
+    if(link_message(type))
+        ensure_link_space(buf, ifp, len + 2);
+    else
+        ensure_space(buf, ifp, len + 2);
     buf->buf[buf->len++] = type;
     buf->buf[buf->len++] = len;
 }
@@ -1214,7 +1657,28 @@ end_message(struct buffered *buf, int type, int bytes)
     assert(buf->len >= bytes + 2 &&
            buf->buf[buf->len - bytes - 2] == type &&
            buf->buf[buf->len - bytes - 1] == bytes);
-    schedule_flush(buf);
+
+    /* Link-maintenance TLVs go before any routing TLVs, so that they are
+       not delayed by updates.  They don't affect the parser state used
+       for compressing updates, so this is safe. */
+    if(link_message(type)) {
+        int start = buf->len - bytes - 2;
+        if(start > buf->link_len) {
+            unsigned char tlv[257];
+            memcpy(tlv, buf->buf + start, bytes + 2);
+            memmove(buf->buf + buf->link_len + bytes + 2,
+                    buf->buf + buf->link_len, start - buf->link_len);
+            memcpy(buf->buf + buf->link_len, tlv, bytes + 2);
+            if(buf->hello == start)
+                buf->hello = buf->link_len;
+        }
+        buf->link_len += bytes + 2;
+        /* Link-maintenance TLVs are flushed on their own, shorter
+           schedule. */
+        schedule_flush_ms(buf, jitter(buf, 1));
+    } else {
+        schedule_flush(buf);
+    }
 }
 
 static void
@@ -1366,8 +1830,10 @@ send_multicast_hello(struct interface *ifp, unsigned interval, int force)
     }
 
     ifp->hello_seqno = seqno_plus(ifp->hello_seqno, 1);
-    if(interval > 0)
+    if(interval > 0) {
         set_timeout(&ifp->hello_timeout, ifp->hello_interval);
+        schedule_timer(&ifp->hello_timeout, TIMER_HELLO, ifp);
+    }
 
     debugf("Sending hello %d (%d) to %s.\n",
            ifp->hello_seqno, interval, ifp->name);
@@ -1529,6 +1995,8 @@ really_buffer_update(struct buffered *buf, struct interface *ifp,
             accumulate_bytes(buf, channels, channels_len);
     }
     end_message(buf, MESSAGE_UPDATE, len);
+    if(metric >= INFINITY)
+        buf->priority = 1;
     if(flags & 0x80) {
         memcpy(buf->prefix, prefix, 16);
         buf->have_prefix = 1;
@@ -1546,14 +2014,16 @@ really_send_update(struct interface *ifp, const unsigned char *id,
     if(!if_up(ifp))
         return;
 
-    if((ifp->flags & IF_UNICAST) != 0) {
+    if(unicast_updates_ifp == ifp) {
+        really_buffer_update(&unicast_updates, ifp, id,
+                             prefix, plen, src_prefix, src_plen, tos,
+                             seqno, metric, channels, channels_len);
+    } else if((ifp->flags & IF_UNICAST) != 0) {
         struct neighbour *neigh;
-        FOR_ALL_NEIGHBOURS(neigh) {
-            if(neigh->ifp == ifp) {
-                really_buffer_update(&neigh->buf, ifp, id,
-                                     prefix, plen, src_prefix, src_plen, tos,
-                                     seqno, metric, channels, channels_len);
-            }
+        FOR_IFP_NEIGHBOURS(ifp, neigh) {
+            really_buffer_update(&neigh->buf, ifp, id,
+                                 prefix, plen, src_prefix, src_plen, tos,
+                                 seqno, metric, channels, channels_len);
         }
     } else {
         really_buffer_update(&ifp->buf, ifp, id,
@@ -1562,64 +2032,265 @@ really_send_update(struct interface *ifp, const unsigned char *id,
     }
 }
 
+static unsigned int
+hash_bytes(unsigned int h, const unsigned char *p, int len)
+{
+    int i;
+    for(i = 0; i < len; i++)
+        h = (h ^ p[i]) * 16777619U;
+    return h;
+}
+
+static unsigned int
+update_hash(const unsigned char *prefix, unsigned char plen,
+            const unsigned char *src_prefix, unsigned char src_plen,
+            const unsigned char *tos)
+{
+    unsigned int h = 2166136261U;
+    h = hash_bytes(h, prefix, 16);
+    h = hash_bytes(h, &plen, 1);
+    h = hash_bytes(h, src_prefix, 16);
+    h = hash_bytes(h, &src_plen, 1);
+    return hash_bytes(h, tos, 1);
+}
+
+/* Number of updates buffered on all interfaces. */
+static int buffered_updates = 0;
+
+static unsigned int
+group_hash(const unsigned char *id, unsigned char v4)
+{
+    unsigned int h = 2166136261U;
+    h = hash_bytes(h, id, 8);
+    return hash_bytes(h, &v4, 1);
+}
+
+/* Returns the index of an update, or -1.  In the latter case, *slot_return
+   is set to the hash slot where it should be inserted. */
 static int
-compare_buffered_updates(const void *av, const void *bv)
+find_pending_update(struct update_set *set,
+                    const unsigned char *prefix, unsigned char plen,
+                    const unsigned char *src_prefix, unsigned char src_plen,
+                    const unsigned char *tos, int *slot_return)
 {
-    const struct buffered_update *a = av, *b = bv;
-    int rc, v4a, v4b, ma, mb;
+    unsigned int mask = set->hashsize - 1;
+    unsigned int h = update_hash(prefix, plen, src_prefix, src_plen, tos);
+
+    while(set->hash[h & mask] >= 0) {
+        struct buffered_update *u = &set->updates[set->hash[h & mask]];
+        if(u->plen == plen && u->src_plen == src_plen &&
+           u->tos[0] == tos[0] &&
+           memcmp(u->prefix, prefix, 16) == 0 &&
+           memcmp(u->src_prefix, src_prefix, 16) == 0)
+            return set->hash[h & mask];
+        h++;
+    }
+    if(slot_return)
+        *slot_return = h & mask;
+    return -1;
+}
 
-    rc = memcmp(a->id, b->id, 8);
-    if(rc != 0)
-        return rc;
+static int
+find_update_group(struct update_set *set,
+                  const unsigned char *id, unsigned char v4, int *slot_return)
+{
+    int *hash = set->hash + set->hashsize;
+    unsigned int mask = set->hashsize - 1;
+    unsigned int h = group_hash(id, v4);
+
+    while(hash[h & mask] >= 0) {
+        struct update_group *g = &set->groups[hash[h & mask]];
+        if(g->v4 == v4 && memcmp(g->id, id, 8) == 0)
+            return hash[h & mask];
+        h++;
+    }
+    if(slot_return)
+        *slot_return = h & mask;
+    return -1;
+}
 
-    v4a = (a->plen >= 96 && v4mapped(a->prefix));
-    v4b = (b->plen >= 96 && v4mapped(b->prefix));
+static int
+resize_update_set(struct update_set *set, int size)
+{
+    struct buffered_update *new_updates;
+    struct update_group *new_groups;
+    int *new_hash;
+    int i, slot, hashsize = 16;
 
-    if(v4a > v4b)
-        return 1;
-    else if(v4a < v4b)
-        return -1;
+    assert(size >= set->num_updates);
 
-    ma = (!v4a && a->plen == 128 && memcmp(a->prefix + 8, a->id, 8) == 0);
-    mb = (!v4b && b->plen == 128 && memcmp(b->prefix + 8, b->id, 8) == 0);
+    while(hashsize < 2 * size)
+        hashsize *= 2;
 
-    if(ma > mb)
+    new_updates = realloc(set->updates, size * sizeof(struct buffered_update));
+    if(new_updates == NULL)
         return -1;
-    else if(mb > ma)
-        return 1;
-
-    if(a->plen < b->plen)
-        return 1;
-    else if(a->plen > b->plen)
+    set->updates = new_updates;
+    new_groups = realloc(set->groups, size * sizeof(struct update_group));
+    if(new_groups == NULL)
         return -1;
+    set->groups = new_groups;
+    new_hash = realloc(set->hash, 2 * hashsize * sizeof(int));
+    if(new_hash == NULL)
+        return -1;
+    set->hash = new_hash;
+    set->size = size;
+    set->hashsize = hashsize;
+
+    for(i = 0; i < 2 * hashsize; i++)
+        set->hash[i] = -1;
+    for(i = 0; i < set->num_updates; i++) {
+        struct buffered_update *u = &set->updates[i];
+        find_pending_update(set, u->prefix, u->plen, u->src_prefix,
+                            u->src_plen, u->tos, &slot);
+        set->hash[slot] = i;
+    }
+    for(i = 0; i < set->num_groups; i++) {
+        find_update_group(set, set->groups[i].id, set->groups[i].v4, &slot);
+        set->hash[set->hashsize + slot] = i;
+    }
+    return 1;
+}
 
-    rc = memcmp(a->prefix, b->prefix, 16);
-    if(rc != 0)
-        return rc;
+void
+free_update_set(struct update_set *set)
+{
+    buffered_updates -= set->num_updates;
+    free(set->updates);
+    free(set->groups);
+    free(set->hash);
+    memset(set, 0, sizeof(struct update_set));
+}
 
-    if(a->src_plen < b->src_plen)
-        return -1;
-    else if(a->src_plen > b->src_plen)
-        return 1;
+/* Called whenever the installed route or the xroute for a prefix changes,
+   so that the next flush doesn't use a stale lookup result. */
+void
+invalidate_buffered_update(const unsigned char *prefix, unsigned char plen,
+                           const unsigned char *src_prefix,
+                           unsigned char src_plen,
+                           const unsigned char *tos)
+{
+    struct interface *ifp;
+    int i;
 
-    rc = memcmp(a->src_prefix, b->src_prefix, 16);
-    if(rc != 0)
-        return rc;
+    if(buffered_updates <= 0)
+        return;
 
-    return memcmp(a->tos, b->tos, 1);;
+    FOR_ALL_INTERFACES(ifp) {
+        if(ifp->updates.num_updates == 0)
+            continue;
+        i = find_pending_update(&ifp->updates, prefix, plen,
+                                src_prefix, src_plen, tos, NULL);
+        if(i >= 0) {
+            ifp->updates.updates[i].valid = 0;
+            ifp->updates.updates[i].route = NULL;
+        }
+    }
 }
 
-void
-flushupdates(struct interface *ifp)
+/* Looks up what to announce for an update.  Route is the installed route
+   for its prefix if the caller already knows it. */
+static void
+resolve_buffered_update(struct buffered_update *u, struct babel_route *route)
 {
     struct xroute *xroute;
+
+    xroute = find_xroute(u->prefix, u->plen, u->src_prefix, u->src_plen,
+                         u->tos);
+    if(route == NULL)
+        route = find_installed_route(u->prefix, u->plen,
+                                     u->src_prefix, u->src_plen, u->tos);
+    if(xroute && (!route || xroute->metric <= kernel_metric)) {
+        u->self = 1;
+        u->metric = xroute->metric;
+        u->route = NULL;
+    } else {
+        u->self = 0;
+        u->route = route;
+    }
+    u->valid = 1;
+}
+
+static void
+flush_buffered_update(struct interface *ifp, struct buffered_update *b)
+{
     struct babel_route *route;
-    const unsigned char *last_prefix = NULL;
-    const unsigned char *last_src_prefix = NULL;
-    unsigned char last_plen = 0xFF;
-    unsigned char last_src_plen = 0xFF;
-    const unsigned char *last_tos = NULL;
-    int i;
+
+    if(!b->valid)
+        resolve_buffered_update(b, NULL);
+    route = b->route;
+
+    if(b->self) {
+        really_send_update(ifp, myid,
+                           b->prefix, b->plen,
+                           b->src_prefix, b->src_plen,
+                           b->tos,
+                           myseqno, b->metric,
+                           NULL, 0);
+    } else if(route) {
+        unsigned char channels[MAX_CHANNEL_HOPS];
+        int chlen;
+        struct interface *route_ifp = route->neigh->ifp;
+        unsigned short metric;
+        unsigned short seqno;
+
+        seqno = route->seqno;
+        metric =
+            route_interferes(route, ifp) ?
+            route_metric(route) :
+            route_metric_noninterfering(route);
+
+        if(metric < INFINITY)
+            satisfy_request(route->src->prefix, route->src->plen,
+                            route->src->src_prefix,
+                            route->src->src_plen,
+                            route->src->tos,
+                            seqno, route->src->id, ifp);
+
+        if((ifp->flags & IF_SPLIT_HORIZON) &&
+           route->neigh->ifp == ifp)
+            return;
+
+        if(route_ifp->channel == IF_CHANNEL_NONINTERFERING) {
+            chlen = MIN(route->channels_len, MAX_CHANNEL_HOPS);
+            if(chlen > 0)
+                memcpy(channels, route->channels, chlen);
+        } else {
+            if(route_ifp->channel == IF_CHANNEL_UNKNOWN)
+                channels[0] = IF_CHANNEL_INTERFERING;
+            else {
+                assert(route_ifp->channel > 0 &&
+                       route_ifp->channel <= 255);
+                channels[0] = route_ifp->channel;
+            }
+            memcpy(channels + 1, route->channels,
+                   MIN(route->channels_len, MAX_CHANNEL_HOPS - 1));
+            chlen = 1 + MIN(route->channels_len, MAX_CHANNEL_HOPS - 1);
+        }
+
+        really_send_update(ifp, route->src->id,
+                           route->src->prefix, route->src->plen,
+                           route->src->src_prefix,
+                           route->src->src_plen,
+                           route->src->tos,
+                           seqno, metric,
+                           channels, chlen);
+        update_source(route->src, seqno, metric);
+    } else {
+    /* There's no route for this prefix.  This can happen shortly
+       after an xroute has been retracted, so send a retraction. */
+        really_send_update(ifp, myid,
+                           b->prefix, b->plen,
+                           b->src_prefix, b->src_plen,
+                           b->tos,
+                           myseqno, INFINITY, NULL, -1);
+    }
+}
+
+void
+flushupdates(struct interface *ifp)
+{
+    int i, v4;
 
     if(ifp == NULL) {
         struct interface *ifp_aux;
@@ -1628,142 +2299,51 @@ flushupdates(struct interface *ifp)
         return;
     }
 
-    if(ifp->num_buffered_updates > 0) {
-        struct buffered_update *b = ifp->buffered_updates;
-        int n = ifp->num_buffered_updates;
+    if(ifp->updates.num_updates > 0) {
+        struct update_set set = ifp->updates;
 
-        ifp->buffered_updates = NULL;
-        ifp->update_bufsize = 0;
-        ifp->num_buffered_updates = 0;
+        memset(&ifp->updates, 0, sizeof(struct update_set));
 
         if(!if_up(ifp))
             goto done;
 
         debugf("  (flushing %d buffered updates on %s (%d))\n",
-               n, ifp->name, ifp->ifindex);
+               set.num_updates, ifp->name, ifp->ifindex);
 
-        /* In order to send fewer update messages, we want to send updates
-           with the same router-id together, with IPv6 going out before IPv4. */
-
-        for(i = 0; i < n; i++) {
-            route = find_installed_route(b[i].prefix, b[i].plen,
-                                         b[i].src_prefix, b[i].src_plen, b[i].tos);
-            if(route)
-                memcpy(b[i].id, route->src->id, 8);
-            else
-                memcpy(b[i].id, myid, 8);
-        }
-
-        qsort(b, n, sizeof(struct buffered_update), compare_buffered_updates);
-
-        for(i = 0; i < n; i++) {
+        if((ifp->flags & IF_UNICAST) != 0)
+            start_unicast_updates(ifp);
+        else
+            trace_buffer(&ifp->buf, set.trace_start, set.trace_tos);
 
-            /* The same update may be scheduled multiple times before it is
-               sent out.  Since our buffer is now sorted, it is enough to
-               compare with the previous update. */
-            if(last_prefix &&
-               b[i].plen == last_plen &&
-               b[i].src_plen == last_src_plen &&
-               memcmp(b[i].prefix, last_prefix, 16) == 0 &&
-               memcmp(b[i].src_prefix, last_src_prefix, 16) == 0 &&
-               last_tos &&
-               memcmp(b[i].tos, last_tos, 1) == 0)
-                continue;
+        /* In order to send fewer update messages, we send updates with
+           the same router-id together, with IPv6 going out before IPv4.
+           Updates were grouped and deduplicated when they were buffered,
+           so that this doesn't need to sort them. */
 
-            xroute = find_xroute(b[i].prefix, b[i].plen,
-                                 b[i].src_prefix, b[i].src_plen, b[i].tos);
-            route = find_installed_route(b[i].prefix, b[i].plen,
-                                         b[i].src_prefix, b[i].src_plen, b[i].tos);
-
-            if(xroute && (!route || xroute->metric <= kernel_metric)) {
-                really_send_update(ifp, myid,
-                                   xroute->prefix, xroute->plen,
-                                   xroute->src_prefix, xroute->src_plen,
-                                   xroute->tos,
-                                   myseqno, xroute->metric,
-                                   NULL, 0);
-                last_prefix = xroute->prefix;
-                last_plen = xroute->plen;
-                last_src_prefix = xroute->src_prefix;
-                last_src_plen = xroute->src_plen;
-                last_tos = xroute->tos;
-            } else if(route) {
-                unsigned char channels[MAX_CHANNEL_HOPS];
-                int chlen;
-                struct interface *route_ifp = route->neigh->ifp;
-                unsigned short metric;
-                unsigned short seqno;
-
-                seqno = route->seqno;
-                metric =
-                    route_interferes(route, ifp) ?
-                    route_metric(route) :
-                    route_metric_noninterfering(route);
-
-                if(metric < INFINITY)
-                    satisfy_request(route->src->prefix, route->src->plen,
-                                    route->src->src_prefix,
-                                    route->src->src_plen,
-                                    route->src->tos,
-                                    seqno, route->src->id, ifp);
-
-                if((ifp->flags & IF_SPLIT_HORIZON) &&
-                   route->neigh->ifp == ifp)
+        for(v4 = 0; v4 <= 1; v4++) {
+            for(i = 0; i < set.num_groups; i++) {
+                int j;
+                if(set.groups[i].v4 != v4)
                     continue;
-
-                if(route_ifp->channel == IF_CHANNEL_NONINTERFERING) {
-                    chlen = MIN(route->channels_len, MAX_CHANNEL_HOPS);
-                    if(chlen > 0)
-                        memcpy(channels, route->channels, chlen);
-                } else {
-                    if(route_ifp->channel == IF_CHANNEL_UNKNOWN)
-                        channels[0] = IF_CHANNEL_INTERFERING;
-                    else {
-                        assert(route_ifp->channel > 0 &&
-                               route_ifp->channel <= 255);
-                        channels[0] = route_ifp->channel;
-                    }
-                    memcpy(channels + 1, route->channels,
-                           MIN(route->channels_len, MAX_CHANNEL_HOPS - 1));
-                    chlen = 1 + MIN(route->channels_len, MAX_CHANNEL_HOPS - 1);
-                }
-
-                really_send_update(ifp, route->src->id,
-                                   route->src->prefix, route->src->plen,
-                                   route->src->src_prefix,
-                                   route->src->src_plen,
-                                   route->src->tos,
-                                   seqno, metric,
-                                   channels, chlen);
-                update_source(route->src, seqno, metric);
-                last_prefix = route->src->prefix;
-                last_plen = route->src->plen;
-                last_src_prefix = route->src->src_prefix;
-                last_src_plen = route->src->src_plen;
-                last_tos = route->src->tos;
-            } else {
-            /* There's no route for this prefix.  This can happen shortly
-               after an xroute has been retracted, so send a retraction. */
-                really_send_update(ifp, myid,
-                                   b[i].prefix, b[i].plen,
-                                   b[i].src_prefix, b[i].src_plen,
-                                   b[i].tos,
-                                   myseqno, INFINITY, NULL, -1);
+                for(j = set.groups[i].first; j >= 0;
+                    j = set.updates[j].next)
+                    flush_buffered_update(ifp, &set.updates[j]);
             }
         }
 
         if((ifp->flags & IF_UNICAST) != 0) {
             struct neighbour *neigh;
-            FOR_ALL_NEIGHBOURS(neigh) {
-                if(neigh->ifp == ifp) {
-                    schedule_flush_now(&neigh->buf);
-                }
+            if(unicast_updates_ifp == ifp)
+                finish_unicast_updates(ifp);
+            FOR_IFP_NEIGHBOURS(ifp, neigh) {
+                trace_buffer(&neigh->buf, set.trace_start, set.trace_tos);
+                schedule_flush_now(&neigh->buf);
             }
         } else {
             schedule_flush_now(&ifp->buf);
         }
     done:
-        free(b);
+        free_update_set(&set);
     }
     ifp->update_flush_timeout.tv_sec = 0;
     ifp->update_flush_timeout.tv_usec = 0;
@@ -1778,50 +2358,82 @@ schedule_update_flush(struct interface *ifp, int urgent)
        timeval_minus_msec(&ifp->update_flush_timeout, &now) < msecs)
         return;
     set_timeout(&ifp->update_flush_timeout, msecs);
+    schedule_timer(&ifp->update_flush_timeout, TIMER_UPDATE_FLUSH, ifp);
 }
 
+/* Route is the installed route for the prefix if the caller knows it,
+   which saves a lookup. */
 static void
-buffer_update(struct interface *ifp,
+buffer_update(struct interface *ifp, struct babel_route *route,
               const unsigned char *prefix, unsigned char plen,
               const unsigned char *src_prefix, unsigned char src_plen,
               const unsigned char *tos)
 {
-    if(ifp->num_buffered_updates > 0 &&
-       ifp->num_buffered_updates >= ifp->update_bufsize)
-        flushupdates(ifp);
-
-    if(ifp->update_bufsize == 0) {
-        int n;
-        assert(ifp->buffered_updates == NULL);
-        /* Allocate enough space to hold a full update.  Since the
-           number of installed routes will grow over time, make sure we
-           have enough space to send a full-ish frame. */
-        n = installed_routes_estimate() + xroutes_estimate() + 4;
-        n = MAX(n, ifp->buf.size / 16);
-    again:
-        ifp->buffered_updates = malloc(n * sizeof(struct buffered_update));
-        if(ifp->buffered_updates == NULL) {
+    struct update_set *set = &ifp->updates;
+    struct buffered_update *u;
+    struct update_group *g;
+    const unsigned char *id;
+    int i, slot, gi;
+
+    if(set->num_updates > 0 &&
+       find_pending_update(set, prefix, plen, src_prefix, src_plen,
+                           tos, NULL) >= 0)
+        return;
+
+    if(set->num_updates >= set->size) {
+        /* Start small, since most flushes only carry a few updates, and
+           double, which keeps the cost of a full update linear. */
+        int n = set->size == 0 ? 16 : 2 * set->size;
+        if(resize_update_set(set, n) < 0) {
             perror("malloc(buffered_updates)");
-            if(n > 4) {
-                /* Try again with a tiny buffer. */
-                n = 4;
-                goto again;
-            }
-            return;
+            /* Send what we have, and try again with a tiny set. */
+            flushupdates(ifp);
+            if(resize_update_set(set, 4) < 0)
+                return;
         }
-        ifp->update_bufsize = n;
-        ifp->num_buffered_updates = 0;
     }
 
-    memcpy(ifp->buffered_updates[ifp->num_buffered_updates].prefix,
-           prefix, 16);
-    ifp->buffered_updates[ifp->num_buffered_updates].plen = plen;
-    memcpy(ifp->buffered_updates[ifp->num_buffered_updates].src_prefix,
-           src_prefix, 16);
-    ifp->buffered_updates[ifp->num_buffered_updates].src_plen = src_plen;
-    memcpy(ifp->buffered_updates[ifp->num_buffered_updates].tos,
-           tos, 1);  //Create last new buffered item here
-    ifp->num_buffered_updates++;
+    i = set->num_updates;
+    find_pending_update(set, prefix, plen, src_prefix, src_plen, tos, &slot);
+    set->hash[slot] = i;
+    set->num_updates++;
+    buffered_updates++;
+
+    if(trace_start != 0 && set->trace_start == 0) {
+        set->trace_start = trace_start;
+        set->trace_tos = tos[0];
+    }
+
+    u = &set->updates[i];
+    memcpy(u->prefix, prefix, 16);
+    u->plen = plen;
+    memcpy(u->src_prefix, src_prefix, 16);
+    u->src_plen = src_plen;
+    memcpy(u->tos, tos, 1);
+    u->v4 = plen >= 96 && v4mapped(prefix);
+    u->next = -1;
+    resolve_buffered_update(u, route);
+    id = u->route ? u->route->src->id : myid;
+
+    gi = find_update_group(set, id, u->v4, &slot);
+    if(gi < 0) {
+        gi = set->num_groups++;
+        set->hash[set->hashsize + slot] = gi;
+        g = &set->groups[gi];
+        memcpy(g->id, id, 8);
+        g->v4 = u->v4;
+        g->first = g->last = i;
+    } else if(!u->v4 && plen == 128 && memcmp(prefix + 8, id, 8) == 0) {
+        /* The prefix that matches the router-id goes first, which allows
+           the receiver to associate the router-id with its address. */
+        g = &set->groups[gi];
+        u->next = g->first;
+        g->first = i;
+    } else {
+        g = &set->groups[gi];
+        set->updates[g->last].next = i;
+        g->last = i;
+    }
 }
 
 /* Full wildcard update with prefix == src_prefix == tos == NULL,
@@ -1856,7 +2468,7 @@ send_update(struct interface *ifp, int urgent,
         debugf("Sending update to %s for %s from %s with TOS %s.\n",
                ifp->name, format_prefix(prefix, plen),
                format_prefix(src_prefix, src_plen), format_tos_value(tos));
-        buffer_update(ifp, prefix, plen, src_prefix, src_plen, tos);
+        buffer_update(ifp, NULL, prefix, plen, src_prefix, src_plen, tos);
     } else if(prefix || src_prefix) {
         struct route_stream *routes;
         send_self_update(ifp);
@@ -1872,7 +2484,8 @@ send_update(struct interface *ifp, int urgent,
                                     route->src->src_plen);
                 if((src_prefix && is_ss) || (prefix && !is_ss))
                     continue;
-                buffer_update(ifp, route->src->prefix, route->src->plen,
+                buffer_update(ifp, route,
+                              route->src->prefix, route->src->plen,
                               route->src->src_prefix, route->src->src_plen, route->src->tos);
             }
             route_stream_done(routes);
@@ -1880,14 +2493,159 @@ send_update(struct interface *ifp, int urgent,
             fprintf(stderr, "Couldn't allocate route stream.\n");
         }
         set_timeout(&ifp->update_timeout, ifp->update_interval);
+        schedule_timer(&ifp->update_timeout, TIMER_UPDATE, ifp);
         ifp->last_update_time = now.tv_sec;
     } else {
+        /* A full update supersedes any periodic update in progress. */
+        ifp->update_cursor.active = 0;
+        ifp->update_slice_timeout.tv_sec = 0;
+        ifp->update_slice_timeout.tv_usec = 0;
         send_update(ifp, urgent, NULL, 0, zeroes, 0, NULL);
         send_update(ifp, urgent, zeroes, 0, NULL, 0, NULL);
     }
     schedule_update_flush(ifp, urgent);
 }
 
+/* Buffers up to count installed routes starting at the cursor, or all the
+   remaining ones if count is negative. */
+static void
+buffer_update_slice(struct interface *ifp, int count)
+{
+    struct update_cursor *c = &ifp->update_cursor;
+    struct route_stream *routes;
+    struct babel_route *route;
+    int n = 0;
+
+    routes = route_stream_from(1, c->prefix, c->plen,
+                               c->src_prefix, c->src_plen, c->tos);
+    if(routes == NULL) {
+        fprintf(stderr, "Couldn't allocate route stream.\n");
+        return;
+    }
+
+    while(1) {
+        route = route_stream_next(routes);
+        if(route == NULL)
+            break;
+        if(count >= 0 && n >= count) {
+            /* Remember where to resume. */
+            memcpy(c->prefix, route->src->prefix, 16);
+            c->plen = route->src->plen;
+            memcpy(c->src_prefix, route->src->src_prefix, 16);
+            c->src_plen = route->src->src_plen;
+            memcpy(c->tos, route->src->tos, 1);
+            break;
+        }
+        buffer_update(ifp, route, route->src->prefix, route->src->plen,
+                      route->src->src_prefix, route->src->src_plen,
+                      route->src->tos);
+        n++;
+    }
+    route_stream_done(routes);
+
+    if(route == NULL) {
+        c->active = 0;
+        ifp->update_slice_timeout.tv_sec = 0;
+        ifp->update_slice_timeout.tv_usec = 0;
+    } else {
+        set_timeout(&ifp->update_slice_timeout, UPDATE_SLICE_INTERVAL);
+        schedule_timer(&ifp->update_slice_timeout, TIMER_UPDATE_SLICE, ifp);
+    }
+    if(n > 0)
+        schedule_update_flush(ifp, 0);
+}
+
+/* Starts a periodic full update.  In order to avoid bursts on large
+   tables, it is sent in slices spread over the update interval. */
+void
+send_periodic_update(struct interface *ifp)
+{
+    struct update_cursor *c = &ifp->update_cursor;
+    int slices;
+
+    if(!if_up(ifp))
+        return;
+
+    /* Don't leave any part of the previous update unsent. */
+    if(c->active)
+        buffer_update_slice(ifp, -1);
+
+    send_self_update(ifp);
+    debugf("Sending periodic update to %s.\n", ifp->name);
+
+    memset(c, 0, sizeof(struct update_cursor));
+    c->active = 1;
+    slices = MAX(1, ifp->update_interval * 3 / 4 / UPDATE_SLICE_INTERVAL);
+    c->slice = MAX(UPDATE_SLICE_MIN,
+                   (installed_routes_estimate() + slices - 1) / slices);
+    set_timeout(&ifp->update_timeout, ifp->update_interval);
+    schedule_timer(&ifp->update_timeout, TIMER_UPDATE, ifp);
+    ifp->last_update_time = now.tv_sec;
+
+    buffer_update_slice(ifp, c->slice);
+    schedule_update_flush(ifp, 0);
+}
+
+void
+send_update_slice(struct interface *ifp)
+{
+    if(!if_up(ifp) || !ifp->update_cursor.active) {
+        ifp->update_slice_timeout.tv_sec = 0;
+        ifp->update_slice_timeout.tv_usec = 0;
+        return;
+    }
+    buffer_update_slice(ifp, ifp->update_cursor.slice);
+}
+
+/* Sends updates for all the routes in a given DSCP class. */
+void
+send_update_tos(struct interface *ifp, const unsigned char *tos)
+{
+    struct xroute_stream *xroutes;
+    struct route_stream *routes;
+
+    if(!if_up(ifp))
+        return;
+
+    debugf("Sending update to %s for any with TOS %s.\n",
+           ifp->name, format_tos_value(tos));
+
+    xroutes = xroute_stream();
+    if(xroutes) {
+        while(1) {
+            struct xroute *xroute = xroute_stream_next(xroutes);
+            if(xroute == NULL)
+                break;
+            if(xroute->tos[0] == tos[0])
+                buffer_update(ifp, NULL, xroute->prefix, xroute->plen,
+                              xroute->src_prefix, xroute->src_plen,
+                              xroute->tos);
+        }
+        xroute_stream_done(xroutes);
+    } else {
+        fprintf(stderr, "Couldn't allocate xroute stream.\n");
+    }
+
+    routes = route_stream(1);
+    if(routes) {
+        while(1) {
+            struct babel_route *route = route_stream_next(routes);
+            if(route == NULL)
+                break;
+            if(route->src->tos[0] == tos[0])
+                buffer_update(ifp, route,
+                              route->src->prefix, route->src->plen,
+                              route->src->src_prefix, route->src->src_plen,
+                              route->src->tos);
+        }
+        route_stream_done(routes);
+    } else {
+        fprintf(stderr, "Couldn't allocate route stream.\n");
+    }
+    ifp->last_update_time = now.tv_sec;
+    schedule_update_flush(ifp, 0);
+}
+
 void
 send_update_resend(struct interface *ifp,
                    const unsigned char *prefix, unsigned char plen,
@@ -1915,6 +2673,7 @@ buffer_wildcard_retraction(struct buffered *buf, struct interface *ifp)
     end_message(buf, MESSAGE_UPDATE, 10);
 
     buf->have_id = 0;
+    buf->priority = 1;
 }
 
 
@@ -1933,10 +2692,8 @@ send_wildcard_retraction(struct interface *ifp)
 
     if((ifp->flags & IF_UNICAST) != 0) {
         struct neighbour *neigh;
-        FOR_ALL_NEIGHBOURS(neigh) {
-            if(neigh->ifp == ifp) {
-                buffer_wildcard_retraction(&neigh->buf, neigh->ifp);
-            }
+        FOR_IFP_NEIGHBOURS(ifp, neigh) {
+            buffer_wildcard_retraction(&neigh->buf, neigh->ifp);
         }
     } else {
         buffer_wildcard_retraction(&ifp->buf, ifp);
@@ -2026,9 +2783,10 @@ send_ihu(struct neighbour *neigh, struct interface *ifp)
 
     if(neigh == NULL) {
         struct neighbour *ngh;
-        FOR_ALL_NEIGHBOURS(ngh) {
-            if(ngh->ifp == ifp)
-                send_ihu(ngh, ifp);
+        if(ifp == NULL)
+            return;
+        FOR_IFP_NEIGHBOURS(ifp, ngh) {
+            send_ihu(ngh, ifp);
         }
         return;
     }
@@ -2066,7 +2824,7 @@ send_ihu(struct neighbour *neigh, struct interface *ifp)
 
     if(send_rtt_data) {
         /* Ensure that there is a Hello in the same packet. */
-        ensure_space(unicast ? &neigh->buf : &ifp->buf, ifp, 14 + 16);
+        ensure_link_space(unicast ? &neigh->buf : &ifp->buf, ifp, 14 + 16);
         if(unicast)
             send_unicast_hello(neigh, 0, 0);
         else
@@ -2085,16 +2843,21 @@ void
 send_marginal_ihu(struct interface *ifp)
 {
     struct neighbour *neigh;
-    FOR_ALL_NEIGHBOURS(neigh) {
-        if(ifp && neigh->ifp != ifp)
-            continue;
+    if(ifp == NULL) {
+        struct interface *ifp_aux;
+        FOR_ALL_INTERFACES(ifp_aux)
+            send_marginal_ihu(ifp_aux);
+        return;
+    }
+    FOR_IFP_NEIGHBOURS(ifp, neigh) {
         if(neigh->txcost >= 384 || (neigh->hello.reach & 0xF000) != 0xF000)
             send_ihu(neigh, ifp);
     }
 }
 
 /* Standard wildcard request with prefix == NULL && src_prefix == zeroes,
-   Specific wildcard request with prefix == zeroes && src_prefix == NULL. */
+   Specific wildcard request with prefix == zeroes && src_prefix == NULL.
+   A wildcard request with a non-default tos only covers that DSCP class. */
 static void
 send_request(struct buffered *buf, struct interface *ifp,
              const unsigned char *prefix, unsigned char plen,
@@ -2110,11 +2873,18 @@ send_request(struct buffered *buf, struct interface *ifp,
 
     if(!prefix) {
         assert(!src_prefix);
-        debugf("sending request for any.\n");
-        start_message(buf, ifp, MESSAGE_REQUEST, 2);
+        debugf("sending request for any with TOS %s.\n",
+               format_tos_value(tos));
+        len = is_tos ? 5 : 2;
+        start_message(buf, ifp, MESSAGE_REQUEST, len);
         accumulate_byte(buf, 0);
         accumulate_byte(buf, 0);
-        end_message(buf, MESSAGE_REQUEST, 2);
+        if(is_tos) {
+            accumulate_byte(buf, SUBTLV_TOS);
+            accumulate_byte(buf, 1);
+            accumulate_byte(buf, tos[0]);
+        }
+        end_message(buf, MESSAGE_REQUEST, len);
         return;
     }
 
@@ -2153,55 +2923,6 @@ send_request(struct buffered *buf, struct interface *ifp,
     end_message(buf, MESSAGE_REQUEST, len);
 }
 
-void
-send_multicast_request(struct interface *ifp,
-                       const unsigned char *prefix, unsigned char plen,
-                       const unsigned char *src_prefix, unsigned char src_plen,
-                       const unsigned char *tos)
-{
-    if(ifp == NULL) {
-        struct interface *ifp_auxn;
-        FOR_ALL_INTERFACES(ifp_auxn) {
-            if(!if_up(ifp_auxn))
-                continue;
-            send_multicast_request(ifp_auxn, prefix, plen, src_prefix, src_plen, tos);
-        }
-        return;
-    }
-
-    if(!if_up(ifp))
-        return;
-
-    /* make sure any buffered updates go out before this request. */
-    flushupdates(ifp);
-
-    if((ifp->flags & IF_UNICAST) != 0) {
-        struct neighbour *neigh;
-        FOR_ALL_NEIGHBOURS(neigh) {
-            if(neigh->ifp == ifp) {
-                send_request(&neigh->buf, ifp, prefix, plen,
-                             src_prefix, src_plen, tos);
-            }
-        }
-    } else {
-        send_request(&ifp->buf, ifp, prefix, plen, src_prefix, src_plen, tos);
-    }
-}
-
-void
-send_unicast_request(struct neighbour *neigh,
-                     const unsigned char *prefix, unsigned char plen,
-                     const unsigned char *src_prefix, unsigned char src_plen,
-                     const unsigned char *tos)
-{
-    if(!if_up(neigh->ifp))
-        return;
-
-    flushupdates(neigh->ifp);
-
-    send_request(&neigh->buf, neigh->ifp, prefix, plen, src_prefix, src_plen, tos);
-}
-
 static void
 send_multihop_request(struct buffered *buf, struct interface *ifp,
                       const unsigned char *prefix, unsigned char plen,
@@ -2256,6 +2977,319 @@ send_multihop_request(struct buffered *buf, struct interface *ifp,
     end_message(buf, MESSAGE_MH_REQUEST, len);
 }
 
+/* Requests are not encoded immediately: they are collected in a batch
+   attached to the buffer, deduplicated, and only encoded when the buffer
+   is flushed, which doesn't delay them any further.  When many route
+   requests are pending, for example after losing a neighbour, they are
+   replaced with a single wildcard request, restricted to their DSCP class
+   if they all share one.  Since the receiver ignores a wildcard request
+   that follows a full update too closely (see parse_packet), this is only
+   done if the last wildcard request sent on this buffer is older than
+   that; otherwise, the requests are sent in batches.  Seqno requests are
+   deduplicated but never replaced. */
+
+#define REQUEST_BATCH_MAX 64
+#define REQUEST_WILDCARD_THRESHOLD 32
+
+struct pending_request {
+    unsigned char prefix[16];
+    unsigned char plen;
+    unsigned char src_prefix[16];
+    unsigned char src_plen;
+    unsigned char tos[1];
+    /* Set for a seqno request. */
+    char multihop;
+    unsigned short seqno;
+    unsigned char id[8];
+    unsigned char hop_count;
+};
+
+struct request_batch {
+    struct pending_request requests[REQUEST_BATCH_MAX];
+    int n;
+    /* Number of route requests in requests. */
+    int num_route;
+    /* Set if a wildcard request is pending, which covers the DSCP class
+       wildcard_tos, or all classes if wildcard_tos is 0. */
+    char wildcard;
+    unsigned char wildcard_tos;
+    /* When we last sent a wildcard request, and the longest hello
+       interval of the receivers, in milliseconds. */
+    time_t wildcard_time;
+    int hello_interval;
+};
+
+static void
+flush_requests(struct buffered *buf, struct interface *ifp)
+{
+    struct request_batch *b = buf->requests;
+    struct pending_request requests[REQUEST_BATCH_MAX];
+    int i, n;
+    char wildcard;
+    unsigned char tos[1];
+
+    if(b == NULL || (b->n == 0 && !b->wildcard))
+        return;
+
+    /* Encoding may flush the buffer, so detach the batch first. */
+    n = b->n;
+    memcpy(requests, b->requests, n * sizeof(struct pending_request));
+    wildcard = b->wildcard;
+    tos[0] = b->wildcard_tos;
+    b->n = 0;
+    b->num_route = 0;
+    b->wildcard = 0;
+
+    if(wildcard) {
+        b->wildcard_time = now.tv_sec;
+        send_request(buf, ifp, NULL, 0, NULL, 0, tos);
+    }
+    for(i = 0; i < n; i++) {
+        struct pending_request *r = &requests[i];
+        if(r->multihop)
+            send_multihop_request(buf, ifp, r->prefix, r->plen,
+                                  r->src_prefix, r->src_plen, r->tos,
+                                  r->seqno, r->id, r->hop_count);
+        else
+            send_request(buf, ifp, r->prefix, r->plen,
+                         r->src_prefix, r->src_plen, r->tos);
+    }
+}
+
+/* Replaces the pending route requests with a wildcard request if there
+   are enough of them and the receivers won't ignore it. */
+static int
+requests_pending(struct buffered *buf)
+{
+    return buf->requests != NULL &&
+        (buf->requests->n > 0 || buf->requests->wildcard);
+}
+
+static void
+coalesce_requests(struct request_batch *b)
+{
+    unsigned char tos;
+    int i, j;
+
+    if(b->wildcard || b->num_route < REQUEST_WILDCARD_THRESHOLD ||
+       b->wildcard_time >= now.tv_sec - MAX(b->hello_interval / 100, 1))
+        return;
+
+    tos = 0;
+    for(i = 0; i < b->n; i++) {
+        if(b->requests[i].multihop)
+            continue;
+        if(is_default_tos(b->requests[i].tos)) {
+            tos = 0;
+            break;
+        }
+        if(tos != 0 && tos != b->requests[i].tos[0]) {
+            tos = 0;
+            break;
+        }
+        tos = b->requests[i].tos[0];
+    }
+
+    j = 0;
+    for(i = 0; i < b->n; i++) {
+        if(b->requests[i].multihop)
+            b->requests[j++] = b->requests[i];
+    }
+    b->n = j;
+    b->num_route = 0;
+    b->wildcard = 1;
+    b->wildcard_tos = tos;
+}
+
+static struct request_batch *
+get_request_batch(struct buffered *buf)
+{
+    if(buf->requests == NULL) {
+        buf->requests = calloc(1, sizeof(struct request_batch));
+        if(buf->requests == NULL)
+            perror("calloc(request_batch)");
+    }
+    return buf->requests;
+}
+
+static void
+add_pending_request(struct buffered *buf, struct interface *ifp,
+                    int hello_interval, const struct pending_request *req)
+{
+    struct request_batch *b = get_request_batch(buf);
+    struct pending_request *r;
+    int i;
+
+    if(b == NULL) {
+        if(req->multihop)
+            send_multihop_request(buf, ifp, req->prefix, req->plen,
+                                  req->src_prefix, req->src_plen,
+                                  req->tos, req->seqno, req->id,
+                                  req->hop_count);
+        else
+            send_request(buf, ifp, req->prefix, req->plen,
+                         req->src_prefix, req->src_plen, req->tos);
+        return;
+    }
+    b->hello_interval = MAX(b->hello_interval, hello_interval);
+
+    if(!req->multihop && b->wildcard &&
+       (b->wildcard_tos == 0 || b->wildcard_tos == req->tos[0]))
+        goto done;
+
+    for(i = 0; i < b->n; i++) {
+        r = &b->requests[i];
+        if(r->multihop == req->multihop &&
+           r->plen == req->plen && r->src_plen == req->src_plen &&
+           r->tos[0] == req->tos[0] &&
+           memcmp(r->prefix, req->prefix, 16) == 0 &&
+           memcmp(r->src_prefix, req->src_prefix, 16) == 0 &&
+           (!r->multihop || memcmp(r->id, req->id, 8) == 0)) {
+            if(r->multihop) {
+                if(seqno_compare(req->seqno, r->seqno) > 0)
+                    r->seqno = req->seqno;
+                r->hop_count = MAX(r->hop_count, req->hop_count);
+            }
+            goto done;
+        }
+    }
+
+    if(b->n >= REQUEST_BATCH_MAX)
+        flush_requests(buf, ifp);
+    b->requests[b->n++] = *req;
+    if(!req->multihop) {
+        b->num_route++;
+        coalesce_requests(b);
+    }
+
+ done:
+    schedule_flush(buf);
+}
+
+static void
+batch_request(struct buffered *buf, struct interface *ifp, int hello_interval,
+              const unsigned char *prefix, unsigned char plen,
+              const unsigned char *src_prefix, unsigned char src_plen,
+              const unsigned char *tos)
+{
+    struct pending_request req;
+    unsigned char t = tos ? tos[0] : 0;
+
+    if(prefix == NULL) {
+        /* An explicit wildcard request is always sent. */
+        struct request_batch *b = get_request_batch(buf);
+        if(b == NULL) {
+            send_request(buf, ifp, NULL, 0, NULL, 0, tos);
+            return;
+        }
+        b->hello_interval = MAX(b->hello_interval, hello_interval);
+        if(!b->wildcard)
+            b->wildcard_tos = t;
+        else if(b->wildcard_tos != t)
+            b->wildcard_tos = 0;
+        b->wildcard = 1;
+        schedule_flush(buf);
+        return;
+    }
+
+    memset(&req, 0, sizeof(req));
+    memcpy(req.prefix, prefix, 16);
+    req.plen = plen;
+    memcpy(req.src_prefix, src_prefix ? src_prefix : zeroes, 16);
+    req.src_plen = src_plen;
+    req.tos[0] = t;
+    add_pending_request(buf, ifp, hello_interval, &req);
+}
+
+static void
+batch_multihop_request(struct buffered *buf, struct interface *ifp,
+                       int hello_interval,
+                       const unsigned char *prefix, unsigned char plen,
+                       const unsigned char *src_prefix, unsigned char src_plen,
+                       const unsigned char *tos,
+                       unsigned short seqno, const unsigned char *id,
+                       unsigned short hop_count)
+{
+    struct pending_request req;
+
+    memset(&req, 0, sizeof(req));
+    memcpy(req.prefix, prefix, 16);
+    req.plen = plen;
+    memcpy(req.src_prefix, src_prefix, 16);
+    req.src_plen = src_plen;
+    req.tos[0] = tos ? tos[0] : 0;
+    req.multihop = 1;
+    req.seqno = seqno;
+    memcpy(req.id, id, 8);
+    req.hop_count = hop_count;
+    add_pending_request(buf, ifp, hello_interval, &req);
+}
+
+/* The hello interval that a neighbour announces, which is what it uses to
+   rate-limit wildcard requests. */
+static int
+neighbour_hello_interval(struct neighbour *neigh)
+{
+    return neigh->hello.interval > 0 ?
+        neigh->hello.interval * 10 : neigh->ifp->hello_interval;
+}
+
+void
+discard_requests(struct buffered *buf)
+{
+    free(buf->requests);
+    buf->requests = NULL;
+}
+
+void
+send_multicast_request(struct interface *ifp,
+                       const unsigned char *prefix, unsigned char plen,
+                       const unsigned char *src_prefix, unsigned char src_plen,
+                       const unsigned char *tos)
+{
+    if(ifp == NULL) {
+        struct interface *ifp_auxn;
+        FOR_ALL_INTERFACES(ifp_auxn) {
+            if(!if_up(ifp_auxn))
+                continue;
+            send_multicast_request(ifp_auxn, prefix, plen, src_prefix, src_plen, tos);
+        }
+        return;
+    }
+
+    if(!if_up(ifp))
+        return;
+
+    /* make sure any buffered updates go out before this request. */
+    flushupdates(ifp);
+
+    if((ifp->flags & IF_UNICAST) != 0) {
+        struct neighbour *neigh;
+        FOR_IFP_NEIGHBOURS(ifp, neigh) {
+            batch_request(&neigh->buf, ifp, neighbour_hello_interval(neigh),
+                          prefix, plen, src_prefix, src_plen, tos);
+        }
+    } else {
+        batch_request(&ifp->buf, ifp, ifp->hello_interval,
+                      prefix, plen, src_prefix, src_plen, tos);
+    }
+}
+
+void
+send_unicast_request(struct neighbour *neigh,
+                     const unsigned char *prefix, unsigned char plen,
+                     const unsigned char *src_prefix, unsigned char src_plen,
+                     const unsigned char *tos)
+{
+    if(!if_up(neigh->ifp))
+        return;
+
+    flushupdates(neigh->ifp);
+
+    batch_request(&neigh->buf, neigh->ifp, neighbour_hello_interval(neigh),
+                  prefix, plen, src_prefix, src_plen, tos);
+}
+
 void
 send_multicast_multihop_request(struct interface *ifp,
                       const unsigned char *prefix, unsigned char plen,
@@ -2283,19 +3317,18 @@ send_multicast_multihop_request(struct interface *ifp,
 
     if((ifp->flags & IF_UNICAST) != 0) {
             struct neighbour *neigh;
-            FOR_ALL_NEIGHBOURS(neigh) {
-                if(neigh->ifp == ifp) {
-                    send_multihop_request(&neigh->buf, neigh->ifp,
-                                          prefix, plen,
-                                          src_prefix, src_plen, tos,
-                                          seqno, id, hop_count);
-                }
+            FOR_IFP_NEIGHBOURS(ifp, neigh) {
+                batch_multihop_request(&neigh->buf, neigh->ifp,
+                                       neighbour_hello_interval(neigh),
+                                       prefix, plen,
+                                       src_prefix, src_plen, tos,
+                                       seqno, id, hop_count);
             }
     } else {
-        send_multihop_request(&ifp->buf, ifp,
-                              prefix, plen,
-                              src_prefix, src_plen, tos,
-                              seqno, id, hop_count);
+        batch_multihop_request(&ifp->buf, ifp, ifp->hello_interval,
+                               prefix, plen,
+                               src_prefix, src_plen, tos,
+                               seqno, id, hop_count);
     }
 
 }
@@ -2310,9 +3343,10 @@ send_unicast_multihop_request(struct neighbour *neigh,
                               unsigned short hop_count)
 {
     flushupdates(neigh->ifp);
-    send_multihop_request(&neigh->buf, neigh->ifp,
-                          prefix, plen, src_prefix, src_plen, tos,
-                          seqno, id, hop_count);
+    batch_multihop_request(&neigh->buf, neigh->ifp,
+                           neighbour_hello_interval(neigh),
+                           prefix, plen, src_prefix, src_plen, tos,
+                           seqno, id, hop_count);
 }
 
 /* Send a request to a well-chosen neighbour and resend.  If there is no
@@ -2336,9 +3370,9 @@ send_request_resend(const unsigned char *prefix, unsigned char plen,
         struct interface *ifp;
         FOR_ALL_INTERFACES(ifp) {
             if(!if_up(ifp)) continue;
-            send_multihop_request(&ifp->buf, ifp,
-                                  prefix, plen, src_prefix, src_plen, tos,
-                                  seqno, id, 127);
+            batch_multihop_request(&ifp->buf, ifp, ifp->hello_interval,
+                                   prefix, plen, src_prefix, src_plen, tos,
+                                   seqno, id, 127);
         }
     }
 }
@@ -23,6 +23,11 @@ THE SOFTWARE.
 
 #define MAX_BUFFERED_UPDATES 200
 #define MAX_HMAC_SPACE 48
+#define LINK_SPACE 64
+/* Periodic updates are spread over 3/4 of the update interval, in slices
+   sent every UPDATE_SLICE_INTERVAL ms of at least UPDATE_SLICE_MIN routes. */
+#define UPDATE_SLICE_INTERVAL 100
+#define UPDATE_SLICE_MIN 64
 
 #define MESSAGE_PAD1 0
 #define MESSAGE_PADN 1
@@ -59,9 +64,19 @@ extern unsigned char packet_header[4];
 
 void parse_packet(const unsigned char *from, struct interface *ifp,
                   const unsigned char *packet, int packetlen,
-                  const unsigned char *to);
+                  const unsigned char *to, int hmac_rc);
+void begin_send_batch(void);
+void end_send_batch(void);
 void flushbuf(struct buffered *buf, struct interface *ifp);
+void send_paced_packets(struct interface *ifp);
+void discard_paced_packets(struct interface *ifp);
+void discard_requests(struct buffered *buf);
 void flushupdates(struct interface *ifp);
+void free_update_set(struct update_set *set);
+void invalidate_buffered_update(const unsigned char *prefix, unsigned char plen,
+                                const unsigned char *src_prefix,
+                                unsigned char src_plen,
+                                const unsigned char *tos);
 int send_pc(struct buffered *buf, struct interface *ifp);
 void send_ack(struct neighbour *neigh, unsigned short nonce,
               unsigned short interval);
@@ -76,6 +91,9 @@ void send_update(struct interface *ifp, int urgent,
                  const unsigned char *prefix, unsigned char plen,
                  const unsigned char *src_prefix, unsigned char src_plen,
                  const unsigned char *tos);
+void send_periodic_update(struct interface *ifp);
+void send_update_slice(struct interface *ifp);
+void send_update_tos(struct interface *ifp, const unsigned char *tos);
 void send_update_resend(struct interface *ifp,
                         const unsigned char *prefix, unsigned char plen,
                         const unsigned char *src_prefix,
@@ -22,6 +22,7 @@ THE SOFTWARE.
 */
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdio.h>
 #include <sys/time.h>
@@ -39,19 +40,70 @@ THE SOFTWARE.
 #include "route.h"
 #include "message.h"
 #include "resend.h"
+#include "timer.h"
 #include "local.h"
 #include "configuration.h"
 
 struct neighbour *neighs = NULL;
 
+/* Neighbours are also indexed by address and interface.  We hash the
+   interface itself rather than its ifindex, which may change while the
+   interface is down. */
+static struct neighbour **neigh_table = NULL;
+static int neigh_buckets = 0, num_neighs = 0;
+
+static unsigned int
+neighbour_hash(const unsigned char *address, struct interface *ifp)
+{
+    unsigned int h = 2166136261U;
+    uintptr_t p = (uintptr_t)ifp;
+    int i;
+
+    for(i = 0; i < 16; i++)
+        h = (h ^ address[i]) * 16777619U;
+    for(i = 0; i < (int)sizeof(p); i++) {
+        h = (h ^ (p & 0xFF)) * 16777619U;
+        p >>= 8;
+    }
+    return h;
+}
+
+static int
+resize_neighbour_table(int buckets)
+{
+    struct neighbour **new_table;
+    struct neighbour *neigh;
+
+    new_table = calloc(buckets, sizeof(struct neighbour*));
+    if(new_table == NULL)
+        return -1;
+
+    FOR_ALL_NEIGHBOURS(neigh) {
+        unsigned int b =
+            neighbour_hash(neigh->address, neigh->ifp) & (buckets - 1);
+        neigh->hash_next = new_table[b];
+        new_table[b] = neigh;
+    }
+    free(neigh_table);
+    neigh_table = new_table;
+    neigh_buckets = buckets;
+    return 1;
+}
+
 static struct neighbour *
 find_neighbour_nocreate(const unsigned char *address, struct interface *ifp)
 {
     struct neighbour *neigh;
-    FOR_ALL_NEIGHBOURS(neigh) {
+
+    if(num_neighs == 0)
+        return NULL;
+
+    neigh = neigh_table[neighbour_hash(address, ifp) & (neigh_buckets - 1)];
+    while(neigh) {
         if(memcmp(address, neigh->address, 16) == 0 &&
            neigh->ifp == ifp)
             return neigh;
+        neigh = neigh->hash_next;
     }
     return NULL;
 }
@@ -59,18 +111,29 @@ find_neighbour_nocreate(const unsigned char *address, struct interface *ifp)
 void
 flush_neighbour(struct neighbour *neigh)
 {
+    struct neighbour **p;
+
     flush_neighbour_routes(neigh);
     flush_resends(neigh);
 
-    if(neighs == neigh) {
-        neighs = neigh->next;
-    } else {
-        struct neighbour *previous = neighs;
-        while(previous->next != neigh)
-            previous = previous->next;
-        previous->next = neigh->next;
-    }
+    *neigh->prev = neigh->next;
+    if(neigh->next)
+        neigh->next->prev = neigh->prev;
+
+    *neigh->if_prev = neigh->if_next;
+    if(neigh->if_next)
+        neigh->if_next->if_prev = neigh->if_prev;
+
+    p = &neigh_table[neighbour_hash(neigh->address, neigh->ifp) &
+                     (neigh_buckets - 1)];
+    while(*p != neigh)
+        p = &(*p)->hash_next;
+    *p = neigh->hash_next;
+    num_neighs--;
+
     local_notify_neighbour(neigh, LOCAL_FLUSH);
+    discard_requests(&neigh->buf);
+    cancel_timers(neigh);
     free(neigh->buf.buf);
     free(neigh);
 }
@@ -81,6 +144,7 @@ find_neighbour(const unsigned char *address, struct interface *ifp)
     struct neighbour *neigh;
     const struct timeval zero = {0, 0};
     unsigned char *buf;
+    unsigned int b;
 
     neigh = find_neighbour_nocreate(address, ifp);
     if(neigh)
@@ -89,6 +153,14 @@ find_neighbour(const unsigned char *address, struct interface *ifp)
     debugf("Creating neighbour %s on %s.\n",
            format_address(address), ifp->name);
 
+    if(num_neighs >= neigh_buckets) {
+        resize_neighbour_table(neigh_buckets < 1 ? 16 : 2 * neigh_buckets);
+        if(neigh_buckets < 1) {
+            perror("calloc(neighbours)");
+            return NULL;
+        }
+    }
+
     buf = malloc(ifp->buf.size);
     if(buf == NULL) {
         perror("malloc(neighbour->buf)");
@@ -119,12 +191,26 @@ find_neighbour(const unsigned char *address, struct interface *ifp)
     neigh->buf.size = ifp->buf.size;
     neigh->buf.hello = -1;
     neigh->buf.flush_interval = ifp->buf.flush_interval;
+    neigh->buf.timer_type = TIMER_NEIGHBOUR_BUF;
+    neigh->buf.timer_owner = neigh;
     neigh->buf.sin6.sin6_family = AF_INET6;
     memcpy(&neigh->buf.sin6.sin6_addr, address, 16);
     neigh->buf.sin6.sin6_port = htons(protocol_port);
     neigh->buf.sin6.sin6_scope_id = ifp->ifindex;
     neigh->next = neighs;
+    if(neighs)
+        neighs->prev = &neigh->next;
+    neigh->prev = &neighs;
     neighs = neigh;
+    neigh->if_next = ifp->neighs;
+    if(ifp->neighs)
+        ifp->neighs->if_prev = &neigh->if_next;
+    neigh->if_prev = &ifp->neighs;
+    ifp->neighs = neigh;
+    b = neighbour_hash(address, ifp) & (neigh_buckets - 1);
+    neigh->hash_next = neigh_table[b];
+    neigh_table[b] = neigh;
+    num_neighs++;
     local_notify_neighbour(neigh, LOCAL_ADD);
     return neigh;
 }
@@ -32,6 +32,10 @@ struct hello_history {
 
 struct neighbour {
     struct neighbour *next;
+    struct neighbour **prev;        /* the pointer to this neighbour */
+    struct neighbour *hash_next;    /* next in the same hash bucket */
+    struct neighbour *if_next;      /* next on the same interface */
+    struct neighbour **if_prev;     /* the pointer to this neighbour */
     /* This is -1 when unknown, so don't make it unsigned */
     unsigned char address[16];
     struct hello_history hello;
@@ -64,6 +68,9 @@ extern struct neighbour *neighs;
 #define FOR_ALL_NEIGHBOURS(_neigh) \
     for(_neigh = neighs; _neigh; _neigh = _neigh->next)
 
+#define FOR_IFP_NEIGHBOURS(_ifp, _neigh) \
+    for(_neigh = (_ifp)->neighs; _neigh; _neigh = _neigh->if_next)
+
 void flush_neighbour(struct neighbour *neigh);
 struct neighbour *find_neighbour(const unsigned char *address,
                                  struct interface *ifp);
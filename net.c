@@ -90,6 +90,13 @@ babel_socket(int port)
     if(rc < 0)
         goto fail;
 
+#ifdef SO_RXQ_OVFL
+    /* Ask for the number of packets dropped by the kernel. */
+    rc = setsockopt(s, SOL_SOCKET, SO_RXQ_OVFL, &one, sizeof(one));
+    if(rc < 0)
+        perror("Couldn't enable drop counting");
+#endif
+
     rc = fcntl(s, F_GETFL, 0);
     if(rc < 0)
         goto fail;
@@ -122,6 +129,35 @@ babel_socket(int port)
     return -1;
 }
 
+/* Parse the control data of a received packet.  Returns 1 if the
+   destination address was found. */
+static int
+parse_cmsg(struct msghdr *msg, unsigned char *dst_return,
+           unsigned int *drops_return)
+{
+    struct cmsghdr *cmsg;
+    int found = 0;
+
+    cmsg = CMSG_FIRSTHDR(msg);
+    while(cmsg != NULL) {
+        if(cmsg->cmsg_level == IPPROTO_IPV6 &&
+           cmsg->cmsg_type == IPV6_PKTINFO) {
+            struct in6_pktinfo *info =(struct in6_pktinfo*)CMSG_DATA(cmsg);
+            memcpy(dst_return, info->ipi6_addr.s6_addr, 16);
+            found = 1;
+        }
+#ifdef SO_RXQ_OVFL
+        else if(cmsg->cmsg_level == SOL_SOCKET &&
+                cmsg->cmsg_type == SO_RXQ_OVFL) {
+            if(drops_return)
+                memcpy(drops_return, CMSG_DATA(cmsg), sizeof(unsigned int));
+        }
+#endif
+        cmsg = CMSG_NXTHDR(msg, cmsg);
+    }
+    return found;
+}
+
 int
 babel_recv(int s, void *buf, int buflen, struct sockaddr *sin, int slen,
            unsigned char *src_return)
@@ -129,7 +165,6 @@ babel_recv(int s, void *buf, int buflen, struct sockaddr *sin, int slen,
     struct iovec iovec;
     struct msghdr msg;
     unsigned char cmsgbuf[128];
-    struct cmsghdr *cmsg;
     int rc, found;
     unsigned char src[16] = {0};
 
@@ -147,20 +182,7 @@ babel_recv(int s, void *buf, int buflen, struct sockaddr *sin, int slen,
     if(rc < 0)
         return rc;
 
-    found = 0;
-    memset(src, 0, 16);
-    cmsg = CMSG_FIRSTHDR(&msg);
-    while(cmsg != NULL) {
-        if(cmsg->cmsg_level == IPPROTO_IPV6 &&
-           cmsg->cmsg_type == IPV6_PKTINFO) {
-            struct in6_pktinfo *info =(struct in6_pktinfo*)CMSG_DATA(cmsg);
-            memcpy(src, info->ipi6_addr.s6_addr, 16);
-            found = 1;
-            break;
-        }
-        cmsg = CMSG_NXTHDR(&msg, cmsg);
-    }
-
+    found = parse_cmsg(&msg, src, NULL);
     if(!found) {
         errno = EDESTADDRREQ;
         return -1;
@@ -170,6 +192,69 @@ babel_recv(int s, void *buf, int buflen, struct sockaddr *sin, int slen,
     return rc;
 }
 
+/* Receive up to n packets with a single system call where available.
+   Packet i is stored at buf + i * buflen, and its length is stored in
+   len_return[i], or -1 if it had no destination address.  If the kernel
+   reports it, drops_return is set to the number of packets dropped since
+   the socket was created.  Returns the number of packets received, or -1
+   if none could be received. */
+int
+babel_recv_batch(int s, unsigned char *buf, int buflen,
+                 struct sockaddr_in6 *sin, unsigned char (*dst_return)[16],
+                 int *len_return, unsigned int *drops_return, int n)
+{
+    int i, rc;
+#ifdef MSG_WAITFORONE
+    struct mmsghdr msgs[RECEIVE_BATCH_MAX];
+    struct iovec iovecs[RECEIVE_BATCH_MAX];
+    unsigned char cmsgbufs[RECEIVE_BATCH_MAX][128];
+
+    if(n > RECEIVE_BATCH_MAX)
+        n = RECEIVE_BATCH_MAX;
+
+    memset(msgs, 0, n * sizeof(struct mmsghdr));
+    for(i = 0; i < n; i++) {
+        iovecs[i].iov_base = buf + i * buflen;
+        iovecs[i].iov_len = buflen;
+        msgs[i].msg_hdr.msg_name = &sin[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in6);
+        msgs[i].msg_hdr.msg_iov = &iovecs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_control = cmsgbufs[i];
+        msgs[i].msg_hdr.msg_controllen = sizeof(cmsgbufs[i]);
+    }
+
+    rc = recvmmsg(s, msgs, n, MSG_WAITFORONE, NULL);
+    if(rc < 0)
+        return rc;
+
+    for(i = 0; i < rc; i++) {
+        if(parse_cmsg(&msgs[i].msg_hdr, dst_return[i], drops_return))
+            len_return[i] = msgs[i].msg_len;
+        else
+            len_return[i] = -1;
+    }
+    return rc;
+#else
+    for(i = 0; i < n; i++) {
+        rc = babel_recv(s, buf + i * buflen, buflen,
+                        (struct sockaddr*)&sin[i], sizeof(struct sockaddr_in6),
+                        dst_return[i]);
+        if(rc < 0) {
+            if(errno == EDESTADDRREQ) {
+                len_return[i] = -1;
+                continue;
+            }
+            if(i == 0)
+                return -1;
+            break;
+        }
+        len_return[i] = rc;
+    }
+    return i;
+#endif
+}
+
 int
 babel_send(int s,
            const void *buf1, int buflen1, const void *buf2, int buflen2,
@@ -212,6 +297,74 @@ babel_send(int s,
     return rc;
 }
 
+/* Send n packets with as few system calls as possible.  A packet that
+   cannot be sent is dropped.  Returns the number of packets sent. */
+int
+babel_send_batch(int s, unsigned char **bufs, const int *lens,
+                 const struct sockaddr_in6 *sins, int n)
+{
+    int i, rc, count = 0, sent = 0;
+#ifdef MSG_WAITFORONE
+    struct mmsghdr msgs[SEND_BATCH_MAX];
+    struct iovec iovecs[SEND_BATCH_MAX];
+
+    if(n > SEND_BATCH_MAX)
+        n = SEND_BATCH_MAX;
+
+    memset(msgs, 0, n * sizeof(struct mmsghdr));
+    for(i = 0; i < n; i++) {
+        iovecs[i].iov_base = bufs[i];
+        iovecs[i].iov_len = lens[i];
+        msgs[i].msg_hdr.msg_name = (struct sockaddr*)&sins[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in6);
+        msgs[i].msg_hdr.msg_iov = &iovecs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    i = 0;
+    while(i < n) {
+        rc = sendmmsg(s, msgs + i, n - i, 0);
+        if(rc < 0) {
+            if(errno == EINTR) {
+                count++;
+                if(count < 100)
+                    continue;
+            } else if(errno == EAGAIN) {
+                int rc2;
+                rc2 = wait_for_fd(1, s, 5);
+                if(rc2 > 0) {
+                    count++;
+                    if(count < 100)
+                        continue;
+                }
+                errno = EAGAIN;
+            }
+            /* Only the first remaining packet failed, skip it. */
+            perror("sendmmsg");
+            i++;
+            count = 0;
+            continue;
+        }
+        /* A partial send, go on with the remaining packets, each of which
+           gets its own retries. */
+        i += rc;
+        sent += rc;
+        count = 0;
+    }
+#else
+    for(i = 0; i < n; i++) {
+        rc = babel_send(s, bufs[i], lens[i], NULL, 0,
+                        (const struct sockaddr*)&sins[i],
+                        sizeof(struct sockaddr_in6));
+        if(rc < 0)
+            perror("send");
+        else
+            sent++;
+    }
+#endif
+    return sent;
+}
+
 int
 tcp_server_socket(int port, int local)
 {
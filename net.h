@@ -20,11 +20,33 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 THE SOFTWARE.
 */
 
+#define RECEIVE_BATCH_MAX 64
+#define SEND_BATCH_MAX 64
+
+/* Number of packets read by a single system call, and maximum number of
+   packets read before going back to the main loop. */
+#define RECEIVE_BATCH 16
+#define RECEIVE_MAX 256
+
+struct receive_stats {
+    unsigned long packets;
+    unsigned long batches;
+    int max_batch;
+    unsigned int drops;
+};
+
+extern struct receive_stats receive_stats;
+
 int babel_socket(int port);
 int babel_recv(int s, void *buf, int buflen, struct sockaddr *sin, int slen,
                unsigned char *src_return);
+int babel_recv_batch(int s, unsigned char *buf, int buflen,
+                     struct sockaddr_in6 *sin, unsigned char (*dst_return)[16],
+                     int *len_return, unsigned int *drops_return, int n);
 int babel_send(int s,
                const void *buf1, int buflen1, const void *buf2, int buflen2,
                const struct sockaddr *sin, int slen);
+int babel_send_batch(int s, unsigned char **bufs, const int *lens,
+                     const struct sockaddr_in6 *sins, int n);
 int tcp_server_socket(int port, int local);
 int unix_server_socket(const char *path);
@@ -24,6 +24,7 @@ THE SOFTWARE.
 #include <sys/time.h>
 #include <time.h>
 #include <string.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -37,7 +38,186 @@ THE SOFTWARE.
 #include "configuration.h"
 
 struct timeval resend_time = {0, 0};
-struct resend *to_resend = NULL;
+
+/* Resends are kept in a hash table with chaining, keyed on kind, prefix,
+   source prefix and DSCP class.  Resends that need to be sent again are
+   also kept in a min-heap ordered by deadline, so that the next resend
+   can be found without walking the whole table. */
+
+static struct resend **resends = NULL;
+static int resend_buckets = 0, num_resends = 0;
+
+static struct resend **resend_heap = NULL;
+static int heap_len = 0, heap_size = 0;
+
+static unsigned int
+resend_hash(int kind, const unsigned char *prefix, unsigned char plen,
+            const unsigned char *src_prefix, unsigned char src_plen,
+            const unsigned char *tos)
+{
+    unsigned int h = 2166136261U;
+    int i;
+
+    h = (h ^ kind) * 16777619U;
+    for(i = 0; i < 16; i++)
+        h = (h ^ prefix[i]) * 16777619U;
+    h = (h ^ plen) * 16777619U;
+    for(i = 0; i < 16; i++)
+        h = (h ^ src_prefix[i]) * 16777619U;
+    h = (h ^ src_plen) * 16777619U;
+    h = (h ^ tos[0]) * 16777619U;
+    return h;
+}
+
+static unsigned int
+resend_bucket(struct resend *resend)
+{
+    return resend_hash(resend->kind, resend->prefix, resend->plen,
+                       resend->src_prefix, resend->src_plen, resend->tos) &
+        (resend_buckets - 1);
+}
+
+static int
+resize_resend_table(int buckets)
+{
+    struct resend **new_resends;
+    int i;
+
+    new_resends = calloc(buckets, sizeof(struct resend*));
+    if(new_resends == NULL)
+        return -1;
+
+    for(i = 0; i < resend_buckets; i++) {
+        struct resend *resend = resends[i];
+        while(resend) {
+            struct resend *next = resend->next;
+            unsigned int b =
+                resend_hash(resend->kind, resend->prefix, resend->plen,
+                            resend->src_prefix, resend->src_plen,
+                            resend->tos) & (buckets - 1);
+            resend->next = new_resends[b];
+            new_resends[b] = resend;
+            resend = next;
+        }
+    }
+    free(resends);
+    resends = new_resends;
+    resend_buckets = buckets;
+    return 1;
+}
+
+static int
+resend_before(struct resend *a, struct resend *b)
+{
+    return timeval_compare(&a->deadline, &b->deadline) < 0;
+}
+
+static void
+heap_set(int i, struct resend *resend)
+{
+    resend_heap[i] = resend;
+    resend->heap_index = i;
+}
+
+static void
+heap_up(int i)
+{
+    struct resend *resend = resend_heap[i];
+    while(i > 0) {
+        int parent = (i - 1) / 2;
+        if(!resend_before(resend, resend_heap[parent]))
+            break;
+        heap_set(i, resend_heap[parent]);
+        i = parent;
+    }
+    heap_set(i, resend);
+}
+
+static void
+heap_down(int i)
+{
+    struct resend *resend = resend_heap[i];
+    while(1) {
+        int child = 2 * i + 1;
+        if(child >= heap_len)
+            break;
+        if(child + 1 < heap_len &&
+           resend_before(resend_heap[child + 1], resend_heap[child]))
+            child++;
+        if(!resend_before(resend_heap[child], resend))
+            break;
+        heap_set(i, resend_heap[child]);
+        i = child;
+    }
+    heap_set(i, resend);
+}
+
+static void
+heap_remove(struct resend *resend)
+{
+    int i = resend->heap_index;
+
+    if(i < 0)
+        return;
+
+    resend->heap_index = -1;
+    heap_len--;
+    if(i < heap_len) {
+        struct resend *last = resend_heap[heap_len];
+        heap_set(i, last);
+        heap_up(i);
+        heap_down(last->heap_index);
+    }
+}
+
+static int
+heap_insert(struct resend *resend)
+{
+    if(heap_len >= heap_size) {
+        int n = heap_size < 1 ? 16 : 2 * heap_size;
+        struct resend **new_heap =
+            realloc(resend_heap, n * sizeof(struct resend*));
+        if(new_heap == NULL)
+            return -1;
+        resend_heap = new_heap;
+        heap_size = n;
+    }
+    heap_set(heap_len, resend);
+    heap_len++;
+    heap_up(heap_len - 1);
+    return 1;
+}
+
+static int
+resend_expired(struct resend *resend)
+{
+    switch(resend->kind) {
+    case RESEND_REQUEST:
+        return timeval_minus_msec(&now, &resend->time) >= REQUEST_TIMEOUT;
+    default:
+        return resend->max <= 0;
+    }
+}
+
+/* Put a resend in the heap if it needs to be resent, or take it out.
+   The deadline counts from now rather than from when the resend was
+   recorded, so that a late do_resend sends each entry at most once. */
+static void
+schedule_resend(struct resend *resend)
+{
+    if(resend->delay > 0 && resend->max > 0 && !resend_expired(resend)) {
+        timeval_add_msec(&resend->deadline, &now, resend->delay);
+        if(resend->heap_index < 0) {
+            if(heap_insert(resend) < 0)
+                perror("realloc(resend_heap)");
+        } else {
+            heap_up(resend->heap_index);
+            heap_down(resend->heap_index);
+        }
+    } else {
+        heap_remove(resend);
+    }
+}
 
 static int
 resend_match(struct resend *resend,
@@ -62,20 +242,18 @@ flush_resends(struct neighbour *neigh)
 static struct resend *
 find_resend(int kind, const unsigned char *prefix, unsigned char plen,
             const unsigned char *src_prefix, unsigned char src_plen,
-            const unsigned char *tos,
-            struct resend **previous_return)
+            const unsigned char *tos)
 {
-    struct resend *current, *previous;
+    struct resend *current;
 
-    previous = NULL;
-    current = to_resend;
+    if(num_resends == 0)
+        return NULL;
+
+    current = resends[resend_hash(kind, prefix, plen, src_prefix, src_plen,
+                                  tos) & (resend_buckets - 1)];
     while(current) {
-        if(resend_match(current, kind, prefix, plen, src_prefix, src_plen, tos)) {
-            if(previous_return)
-                *previous_return = previous;
+        if(resend_match(current, kind, prefix, plen, src_prefix, src_plen, tos))
             return current;
-        }
-        previous = current;
         current = current->next;
     }
 
@@ -85,11 +263,9 @@ find_resend(int kind, const unsigned char *prefix, unsigned char plen,
 struct resend *
 find_request(const unsigned char *prefix, unsigned char plen,
              const unsigned char *src_prefix, unsigned char src_plen,
-             const unsigned char *tos,
-             struct resend **previous_return)
+             const unsigned char *tos)
 {
-    return find_resend(RESEND_REQUEST, prefix, plen, src_prefix, src_plen, tos,
-                       previous_return);
+    return find_resend(RESEND_REQUEST, prefix, plen, src_prefix, src_plen, tos);
 }
 
 int
@@ -114,7 +290,7 @@ record_resend(int kind, const unsigned char *prefix, unsigned char plen,
     if(delay >= 0xFFFF)
         delay = 0xFFFF;
 
-    resend = find_resend(kind, prefix, plen, src_prefix, src_plen, tos,NULL);
+    resend = find_resend(kind, prefix, plen, src_prefix, src_plen, tos);
     if(resend) {
         if(resend->delay && delay)
             resend->delay = MIN(resend->delay, delay);
@@ -122,6 +298,8 @@ record_resend(int kind, const unsigned char *prefix, unsigned char plen,
             resend->delay = delay;
         resend->time = now;
         resend->max = RESEND_MAX;
+        schedule_resend(resend);
+        recompute_resend_time();
         if(id && memcmp(resend->id, id, 8) == 0 &&
            seqno_compare(resend->seqno, seqno) > 0) {
             return 0;
@@ -134,6 +312,12 @@ record_resend(int kind, const unsigned char *prefix, unsigned char plen,
         if(resend->ifp != ifp)
             resend->ifp = NULL;
     } else {
+        unsigned int b;
+        if(num_resends >= resend_buckets) {
+            resize_resend_table(resend_buckets < 1 ? 64 : 2 * resend_buckets);
+            if(resend_buckets < 1)
+                return -1;
+        }
         resend = calloc(1, sizeof(struct resend));
         if(resend == NULL)
             return -1;
@@ -150,29 +334,18 @@ record_resend(int kind, const unsigned char *prefix, unsigned char plen,
             memcpy(resend->id, id, 8);
         resend->ifp = ifp;
         resend->time = now;
-        resend->next = to_resend;
-        to_resend = resend;
+        resend->heap_index = -1;
+        b = resend_bucket(resend);
+        resend->next = resends[b];
+        resends[b] = resend;
+        num_resends++;
+        schedule_resend(resend);
+        recompute_resend_time();
     }
 
-    if(resend->delay) {
-        struct timeval timeout;
-        timeval_add_msec(&timeout, &resend->time, resend->delay);
-        timeval_min(&resend_time, &timeout);
-    }
     return 1;
 }
 
-static int
-resend_expired(struct resend *resend)
-{
-    switch(resend->kind) {
-    case RESEND_REQUEST:
-        return timeval_minus_msec(&now, &resend->time) >= REQUEST_TIMEOUT;
-    default:
-        return resend->max <= 0;
-    }
-}
-
 int
 unsatisfied_request(const unsigned char *prefix, unsigned char plen,
                     const unsigned char *src_prefix, unsigned char src_plen,
@@ -181,7 +354,7 @@ unsatisfied_request(const unsigned char *prefix, unsigned char plen,
 {
     struct resend *request;
 
-    request = find_request(prefix, plen, src_prefix, src_plen, tos, NULL);
+    request = find_request(prefix, plen, src_prefix, src_plen, tos);
     if(request == NULL || resend_expired(request))
         return 0;
 
@@ -202,7 +375,7 @@ request_redundant(struct interface *ifp,
 {
     struct resend *request;
 
-    request = find_request(prefix, plen, src_prefix, src_plen, tos, NULL);
+    request = find_request(prefix, plen, src_prefix, src_plen, tos);
     if(request == NULL || resend_expired(request))
         return 0;
 
@@ -232,9 +405,9 @@ satisfy_request(const unsigned char *prefix, unsigned char plen,
                 unsigned short seqno, const unsigned char *id,
                 struct interface *ifp)
 {
-    struct resend *request, *previous;
+    struct resend *request;
 
-    request = find_request(prefix, plen, src_prefix, src_plen, tos, &previous);
+    request = find_request(prefix, plen, src_prefix, src_plen, tos);
     if(request == NULL)
         return 0;
 
@@ -243,10 +416,11 @@ satisfy_request(const unsigned char *prefix, unsigned char plen,
 
     if(memcmp(request->id, id, 8) != 0 ||
        seqno_compare(request->seqno, seqno) <= 0) {
-        /* We cannot remove the request, as we may be walking the list right
+        /* We cannot free the request, as do_resend may be using it right
            now.  Mark it as expired, so that expire_resend will remove it. */
         request->max = 0;
         request->time.tv_sec = 0;
+        heap_remove(request);
         recompute_resend_time();
         return 1;
     }
@@ -257,49 +431,39 @@ satisfy_request(const unsigned char *prefix, unsigned char plen,
 void
 expire_resend()
 {
-    struct resend *current, *previous;
-    int recompute = 0;
-
-    previous = NULL;
-    current = to_resend;
-    while(current) {
-        if(resend_expired(current)) {
-            if(previous == NULL) {
-                to_resend = current->next;
+    int i;
+
+    for(i = 0; i < resend_buckets; i++) {
+        struct resend *current = resends[i], *previous = NULL;
+        while(current) {
+            if(resend_expired(current)) {
+                struct resend *next = current->next;
+                if(previous == NULL)
+                    resends[i] = next;
+                else
+                    previous->next = next;
+                heap_remove(current);
                 free(current);
-                current = to_resend;
+                num_resends--;
+                current = next;
             } else {
-                previous->next = current->next;
-                free(current);
-                current = previous->next;
+                previous = current;
+                current = current->next;
             }
-            recompute = 1;
-        } else {
-            previous = current;
-            current = current->next;
         }
     }
-    if(recompute)
-        recompute_resend_time();
+    recompute_resend_time();
 }
 
 void
 recompute_resend_time()
 {
-    struct resend *request;
-    struct timeval resend = {0, 0};
-
-    request = to_resend;
-    while(request) {
-        if(!resend_expired(request) && request->delay > 0 && request->max > 0) {
-            struct timeval timeout;
-            timeval_add_msec(&timeout, &request->time, request->delay);
-            timeval_min(&resend, &timeout);
-        }
-        request = request->next;
+    if(heap_len > 0) {
+        resend_time = resend_heap[0]->deadline;
+    } else {
+        resend_time.tv_sec = 0;
+        resend_time.tv_usec = 0;
     }
-
-    resend_time = resend;
 }
 
 void
@@ -307,34 +471,34 @@ do_resend()
 {
     struct resend *resend;
 
-    resend = to_resend;
-    while(resend) {
-        if(!resend_expired(resend) && resend->delay > 0 && resend->max > 0) {
-            struct timeval timeout;
-            timeval_add_msec(&timeout, &resend->time, resend->delay);
-            if(timeval_compare(&now, &timeout) >= 0) {
-                switch(resend->kind) {
-                case RESEND_REQUEST:
-                    send_multicast_multihop_request(resend->ifp,
-                                                    resend->prefix, resend->plen,
-                                                    resend->src_prefix,
-                                                    resend->src_plen,
-                                                    resend->tos,
-                                                    resend->seqno, resend->id,
-                                                    127);
-                    break;
-                case RESEND_UPDATE:
-                    send_update(resend->ifp, 1,
-                                resend->prefix, resend->plen,
-                                resend->src_prefix, resend->src_plen, resend->tos);
-                    break;
-                default: abort();
-                }
-                resend->delay = MIN(0xFFFF, resend->delay * 2);
-                resend->max--;
-            }
+    while(heap_len > 0) {
+        resend = resend_heap[0];
+        if(timeval_compare(&now, &resend->deadline) < 0)
+            break;
+        if(resend_expired(resend)) {
+            heap_remove(resend);
+            continue;
+        }
+        switch(resend->kind) {
+        case RESEND_REQUEST:
+            send_multicast_multihop_request(resend->ifp,
+                                            resend->prefix, resend->plen,
+                                            resend->src_prefix,
+                                            resend->src_plen,
+                                            resend->tos,
+                                            resend->seqno, resend->id,
+                                            127);
+            break;
+        case RESEND_UPDATE:
+            send_update(resend->ifp, 1,
+                        resend->prefix, resend->plen,
+                        resend->src_prefix, resend->src_plen, resend->tos);
+            break;
+        default: abort();
         }
-        resend = resend->next;
+        resend->delay = MIN(0xFFFF, resend->delay * 2);
+        resend->max--;
+        schedule_resend(resend);
     }
     recompute_resend_time();
 }
@@ -40,15 +40,17 @@ struct resend {
     unsigned short seqno;
     unsigned char id[8];
     struct interface *ifp;
-    struct resend *next;
+    /* When to resend next, valid while in the heap. */
+    struct timeval deadline;
+    int heap_index;             /* -1 if not in the heap */
+    struct resend *next;        /* next in the same hash bucket */
 };
 
 extern struct timeval resend_time;
 
 struct resend *find_request(const unsigned char *prefix, unsigned char plen,
                     const unsigned char *src_prefix, unsigned char src_plen,
-                    const unsigned char *tos,
-                    struct resend **previous_return);
+                    const unsigned char *tos);
 void flush_resends(struct neighbour *neigh);
 int record_resend(int kind, const unsigned char *prefix, unsigned char plen,
                   const unsigned char *src_prefix, unsigned char src_plen,
@@ -0,0 +1,396 @@
+/*
+Copyright (c) 2007, 2008 by Juliusz Chroboczek
+Copyright (c) 2021 by Florian Wiedner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+
+#include "babeld.h"
+#include "util.h"
+#include "kernel.h"
+#include "kernel_worker.h"
+#include "interface.h"
+#include "neighbour.h"
+#include "source.h"
+#include "route.h"
+#include "restart.h"
+
+#define RESTART_MAGIC "BABELWR2"
+#define RESTART_HEADER_LEN 20
+#define ROUTE_RECORD_LEN 64
+
+char *restart_file = NULL;
+int restart_hold_time = 120;
+time_t stale_routes_time = 0;
+
+/* Sorted in the same order as the route table, so that install_route
+   can find a stale route quickly. */
+static struct stale_route *stale_routes = NULL;
+static int num_stale_routes = 0, live_stale_routes = 0;
+
+static int
+stale_route_compare(const unsigned char *prefix, unsigned char plen,
+                    const unsigned char *src_prefix, unsigned char src_plen,
+                    const unsigned char *tos,
+                    const struct stale_route *stale)
+{
+    int rc;
+
+    if(plen != stale->plen)
+        return plen < stale->plen ? -1 : 1;
+    rc = memcmp(prefix, stale->prefix, 16);
+    if(rc != 0)
+        return rc;
+    if(src_plen != stale->src_plen)
+        return src_plen < stale->src_plen ? -1 : 1;
+    rc = memcmp(src_prefix, stale->src_prefix, 16);
+    if(rc != 0)
+        return rc;
+    return memcmp(tos, stale->tos, 1);
+}
+
+static int
+stale_route_sort(const void *a, const void *b)
+{
+    const struct stale_route *s = a;
+    return stale_route_compare(s->prefix, s->plen,
+                               s->src_prefix, s->src_plen, s->tos, b);
+}
+
+struct stale_route *
+find_stale_route(const unsigned char *prefix, unsigned char plen,
+                 const unsigned char *src_prefix, unsigned char src_plen,
+                 const unsigned char *tos)
+{
+    int p, m, g, c;
+
+    if(live_stale_routes == 0)
+        return NULL;
+
+    p = 0; g = num_stale_routes - 1;
+    while(p <= g) {
+        m = (p + g) / 2;
+        c = stale_route_compare(prefix, plen, src_prefix, src_plen, tos,
+                                &stale_routes[m]);
+        if(c == 0)
+            return stale_routes[m].flushed ? NULL : &stale_routes[m];
+        else if(c < 0)
+            g = m - 1;
+        else
+            p = m + 1;
+    }
+    return NULL;
+}
+
+/* Called when the kernel route has been taken over by a live route. */
+void
+release_stale_route(struct stale_route *stale)
+{
+    if(stale->flushed)
+        return;
+    stale->flushed = 1;
+    live_stale_routes--;
+    if(live_stale_routes == 0) {
+        free(stale_routes);
+        stale_routes = NULL;
+        num_stale_routes = 0;
+        stale_routes_time = 0;
+    }
+}
+
+static void
+flush_stale_failed(const struct kernel_op *op, int error)
+{
+    errno = error;
+    perror("kernel_route(FLUSH stale)");
+}
+
+void
+flush_stale_routes(void)
+{
+    int i, n = 0;
+
+    for(i = 0; i < num_stale_routes; i++) {
+        struct stale_route *stale = &stale_routes[i];
+        if(stale->flushed)
+            continue;
+        debugf("Flushing stale route %s from %s.\n",
+               format_prefix(stale->prefix, stale->plen),
+               format_prefix(stale->src_prefix, stale->src_plen));
+        kernel_route_async(ROUTE_FLUSH, stale->table,
+                           stale->prefix, stale->plen,
+                           stale->src_prefix, stale->src_plen, stale->tos,
+                           NULL, stale->nexthop, stale->ifindex,
+                           stale->metric, NULL, 0, 0, 0,
+                           flush_stale_failed, 0);
+        n++;
+    }
+    if(n > 0)
+        fprintf(stderr, "Flushed %d stale routes.\n", n);
+
+    free(stale_routes);
+    stale_routes = NULL;
+    num_stale_routes = 0;
+    live_stale_routes = 0;
+    stale_routes_time = 0;
+}
+
+static int
+write_route_record(FILE *out,
+                   const unsigned char *prefix, unsigned char plen,
+                   const unsigned char *src_prefix, unsigned char src_plen,
+                   const unsigned char *tos, const unsigned char *nexthop,
+                   int ifindex, unsigned int metric, int table)
+{
+    unsigned char buf[ROUTE_RECORD_LEN];
+
+    memset(buf, 0, sizeof(buf));
+    memcpy(buf, prefix, 16);
+    buf[16] = plen;
+    memcpy(buf + 17, src_prefix, 16);
+    buf[33] = src_plen;
+    buf[34] = tos[0];
+    memcpy(buf + 35, nexthop, 16);
+    DO_HTONL(buf + 51, ifindex);
+    DO_HTONL(buf + 55, metric);
+    DO_HTONL(buf + 59, table);
+    return fwrite(buf, ROUTE_RECORD_LEN, 1, out) == 1 ? 0 : -1;
+}
+
+/* Stale routes that haven't been taken over are still in the kernel,
+   so they go into the snapshot together with the installed routes. */
+static int
+write_routes(FILE *out)
+{
+    struct route_stream *routes;
+    struct babel_route *route;
+    int i, rc, count = 0;
+
+    for(i = 0; i < num_stale_routes; i++) {
+        struct stale_route *stale = &stale_routes[i];
+        if(stale->flushed)
+            continue;
+        rc = write_route_record(out, stale->prefix, stale->plen,
+                                stale->src_prefix, stale->src_plen,
+                                stale->tos, stale->nexthop, stale->ifindex,
+                                stale->metric, stale->table);
+        if(rc < 0)
+            return -1;
+        count++;
+    }
+
+    routes = route_stream(1);
+    if(routes == NULL)
+        return -1;
+
+    while(1) {
+        int table;
+        unsigned int metric;
+
+        route = route_stream_next(routes);
+        if(route == NULL)
+            break;
+
+        kernel_route_params(route, &table, &metric);
+        rc = write_route_record(out, route->src->prefix, route->src->plen,
+                                route->src->src_prefix, route->src->src_plen,
+                                route->src->tos, route->nexthop,
+                                route->neigh->ifp->ifindex, metric, table);
+        if(rc < 0) {
+            count = -1;
+            break;
+        }
+        count++;
+    }
+    route_stream_done(routes);
+    return count;
+}
+
+static int
+read_routes(FILE *in, int count)
+{
+    unsigned char buf[ROUTE_RECORD_LEN];
+    int i, n = 0;
+
+    if(count <= 0)
+        return 0;
+
+    stale_routes = calloc(count, sizeof(struct stale_route));
+    if(stale_routes == NULL)
+        return -1;
+
+    for(i = 0; i < count; i++) {
+        struct stale_route *stale = &stale_routes[n];
+        unsigned int ifindex, table;
+
+        if(fread(buf, ROUTE_RECORD_LEN, 1, in) != 1)
+            break;
+        if(buf[16] > 128 || buf[33] > 128)
+            continue;
+        memcpy(stale->prefix, buf, 16);
+        stale->plen = buf[16];
+        memcpy(stale->src_prefix, buf + 17, 16);
+        stale->src_plen = buf[33];
+        stale->tos[0] = buf[34];
+        memcpy(stale->nexthop, buf + 35, 16);
+        DO_NTOHL(ifindex, buf + 51);
+        DO_NTOHL(stale->metric, buf + 55);
+        DO_NTOHL(table, buf + 59);
+        stale->ifindex = ifindex;
+        stale->table = table;
+        n++;
+    }
+
+    qsort(stale_routes, n, sizeof(struct stale_route), stale_route_sort);
+    num_stale_routes = live_stale_routes = n;
+    if(n == 0) {
+        free(stale_routes);
+        stale_routes = NULL;
+    }
+    return n;
+}
+
+/* Returns the number of stale routes adopted, or -1. */
+int
+read_restart_state(void)
+{
+    unsigned char header[RESTART_HEADER_LEN];
+    unsigned int nsources, nroutes, saved, wall;
+    FILE *in;
+    int rc;
+
+    if(restart_file == NULL)
+        return 0;
+
+    in = fopen(restart_file, "r");
+    if(in == NULL) {
+        if(errno != ENOENT)
+            perror("open(restart-file)");
+        return errno == ENOENT ? 0 : -1;
+    }
+    /* A snapshot is only good once. */
+    rc = unlink(restart_file);
+    if(rc < 0) {
+        perror("unlink(restart-file)");
+        fclose(in);
+        return -1;
+    }
+
+    if(fread(header, RESTART_HEADER_LEN, 1, in) != 1 ||
+       memcmp(header, RESTART_MAGIC, 8) != 0) {
+        fprintf(stderr, "Couldn't parse restart file.\n");
+        fclose(in);
+        return -1;
+    }
+    DO_NTOHL(nsources, header + 8);
+    DO_NTOHL(nroutes, header + 12);
+    DO_NTOHL(saved, header + 16);
+    wall = time(NULL);
+
+    rc = load_sources(in, nsources, wall > saved ? wall - saved : 0);
+    if(rc < 0) {
+        fprintf(stderr, "Truncated restart file.\n");
+        fclose(in);
+        return -1;
+    }
+    debugf("Restored %d sources.\n", rc);
+
+    rc = read_routes(in, nroutes);
+    fclose(in);
+    if(rc < 0)
+        return -1;
+
+    if(rc > 0) {
+        stale_routes_time = now.tv_sec + restart_hold_time;
+        fprintf(stderr, "Adopted %d stale routes for %d seconds.\n",
+                rc, restart_hold_time);
+    }
+    return rc;
+}
+
+/* Written to a temporary file and renamed, so that we never leave a
+   partial snapshot behind. */
+int
+write_restart_state(void)
+{
+    unsigned char header[RESTART_HEADER_LEN];
+    char tmp[1024];
+    FILE *out;
+    int nsources, nroutes, rc;
+
+    if(restart_file == NULL)
+        return -1;
+
+    rc = snprintf(tmp, sizeof(tmp), "%s.tmp", restart_file);
+    if(rc < 0 || rc >= sizeof(tmp)) {
+        fprintf(stderr, "Restart file name too long.\n");
+        return -1;
+    }
+
+    out = fopen(tmp, "w");
+    if(out == NULL) {
+        perror("open(restart-file)");
+        return -1;
+    }
+
+    memset(header, 0, sizeof(header));
+    if(fwrite(header, RESTART_HEADER_LEN, 1, out) != 1)
+        goto fail;
+    nsources = dump_sources(out);
+    if(nsources < 0)
+        goto fail;
+    nroutes = write_routes(out);
+    if(nroutes < 0)
+        goto fail;
+
+    memcpy(header, RESTART_MAGIC, 8);
+    DO_HTONL(header + 8, nsources);
+    DO_HTONL(header + 12, nroutes);
+    DO_HTONL(header + 16, (unsigned int)time(NULL));
+    if(fseek(out, 0, SEEK_SET) < 0 ||
+       fwrite(header, RESTART_HEADER_LEN, 1, out) != 1 ||
+       fflush(out) != 0)
+        goto fail;
+    fsync(fileno(out));
+    fclose(out);
+
+    rc = rename(tmp, restart_file);
+    if(rc < 0) {
+        perror("rename(restart-file)");
+        unlink(tmp);
+        return -1;
+    }
+    debugf("Saved %d sources and %d routes.\n", nsources, nroutes);
+    return nroutes;
+
+ fail:
+    perror("write(restart-file)");
+    fclose(out);
+    unlink(tmp);
+    return -1;
+}
@@ -0,0 +1,57 @@
+/*
+Copyright (c) 2007, 2008 by Juliusz Chroboczek
+Copyright (c) 2021 by Florian Wiedner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* Warm restart: on exit, the routes that we have installed are left in
+   the kernel, and a snapshot of the source table and of the installed
+   routes is written to restart_file.  At startup, the routes in the
+   snapshot are considered stale: install_route takes them over when it
+   installs a route to the same destination, and the ones that haven't
+   come back after restart_hold_time seconds are flushed. */
+
+struct stale_route {
+    unsigned char prefix[16];
+    unsigned char plen;
+    unsigned char src_prefix[16];
+    unsigned char src_plen;
+    unsigned char tos[1];
+    unsigned char nexthop[16];
+    int ifindex;
+    unsigned int metric;
+    int table;
+    int flushed;
+};
+
+extern char *restart_file;
+extern int restart_hold_time;
+/* Time at which the remaining stale routes are flushed, or 0. */
+extern time_t stale_routes_time;
+
+int read_restart_state(void);
+int write_restart_state(void);
+struct stale_route *find_stale_route(const unsigned char *prefix,
+                                     unsigned char plen,
+                                     const unsigned char *src_prefix,
+                                     unsigned char src_plen,
+                                     const unsigned char *tos);
+void release_stale_route(struct stale_route *stale);
+void flush_stale_routes(void);
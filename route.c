@@ -31,6 +31,7 @@ THE SOFTWARE.
 #include "babeld.h"
 #include "util.h"
 #include "kernel.h"
+#include "kernel_worker.h"
 #include "interface.h"
 #include "source.h"
 #include "neighbour.h"
@@ -40,6 +41,9 @@ THE SOFTWARE.
 #include "resend.h"
 #include "configuration.h"
 #include "local.h"
+#include "restart.h"
+#include "trace.h"
+#include "lookup.h"
 
 struct babel_route **routes = NULL;
 static int route_slots = 0, max_route_slots = 0;
@@ -170,6 +174,28 @@ find_installed_route(const unsigned char *prefix, unsigned char plen,
     return NULL;
 }
 
+/* Keeps the lookup index and the buffered updates in sync with the
+   installed flag. */
+static void
+set_route_installed(struct babel_route *route, int installed)
+{
+    if(route->installed == installed)
+        return;
+
+    route->installed = installed;
+    if(installed)
+        add_lookup_entry(route->src->prefix, route->src->plen,
+                         route->src->src_prefix, route->src->src_plen,
+                         route->src->tos, route);
+    else
+        flush_lookup_entry(route->src->prefix, route->src->plen,
+                           route->src->src_prefix, route->src->src_plen,
+                           route->src->tos, route);
+    invalidate_buffered_update(route->src->prefix, route->src->plen,
+                               route->src->src_prefix, route->src->src_plen,
+                               route->src->tos);
+}
+
 /* Returns an overestimate of the number of installed routes. */
 int
 installed_routes_estimate(void)
@@ -314,6 +340,19 @@ flush_all_routes()
     check_sources_released();
 }
 
+/* Forget that routes are installed without touching the kernel, so that
+   they survive a warm restart. */
+void
+forget_installed_routes(void)
+{
+    int i;
+
+    for(i = 0; i < route_slots; i++) {
+        if(routes[i]->installed)
+            set_route_installed(routes[i], 0);
+    }
+}
+
 void
 flush_neighbour_routes(struct neighbour *neigh)
 {
@@ -382,6 +421,29 @@ route_stream(int installed)
     return stream;
 }
 
+/* Like route_stream, but starts at the first destination that is not
+   smaller than the given one, which need not exist. */
+struct route_stream *
+route_stream_from(int installed,
+                  const unsigned char *prefix, unsigned char plen,
+                  const unsigned char *src_prefix, unsigned char src_plen,
+                  const unsigned char *tos)
+{
+    struct route_stream *stream;
+    int i, n = -1;
+
+    stream = route_stream(installed);
+    if(stream == NULL)
+        return NULL;
+
+    i = find_route_slot(prefix, plen, src_prefix, src_plen, tos, &n);
+    if(i < 0)
+        i = n;
+    stream->index = installed ? i : i - 1;
+
+    return stream;
+}
+
 struct babel_route *
 route_stream_next(struct route_stream *stream)
 {
@@ -447,35 +509,122 @@ move_installed_route(struct babel_route *route, int i)
     }
 }
 
+/* Every change that installs a route is tagged, so that the failure of
+   a change that has since been superseded is ignored. */
+static unsigned int kernel_seqno = 0;
+
+static unsigned int
+tag_route(struct babel_route *route)
+{
+    route->kernel_seqno = ++kernel_seqno;
+    return route->kernel_seqno;
+}
+
+/* Called from the main loop when a change queued by change_route has
+   failed.  The kernel doesn't have the route that we believe to be
+   installed, so stop believing it; the next switch will try again. */
+static void
+change_route_failed(const struct kernel_op *op, int error)
+{
+    struct babel_route *route;
+    const unsigned char *gate;
+    int ifindex;
+
+    errno = error;
+    if(op->operation == ROUTE_FLUSH) {
+        perror("kernel_route(FLUSH)");
+        return;
+    }
+    perror(op->operation == ROUTE_ADD ?
+           "kernel_route(ADD)" : "kernel_route(MODIFY)");
+
+    gate = op->operation == ROUTE_ADD ? op->gate : op->newgate;
+    ifindex = op->operation == ROUTE_ADD ? op->ifindex : op->newifindex;
+
+    route = find_installed_route(op->dest, op->plen,
+                                 op->src, op->src_plen, op->tos);
+    if(route == NULL || route->kernel_seqno != op->cookie ||
+       memcmp(route->nexthop, gate, 16) != 0 ||
+       route->neigh->ifp->ifindex != ifindex)
+        return;
+
+    set_route_installed(route, 0);
+    local_notify_route(route, LOCAL_CHANGE);
+}
+
+/* The kernel table of a route, and its preferred source if any. */
 static int
-change_route(int operation, const struct babel_route *route, int metric,
-             const unsigned char *new_next_hop,
-             int new_ifindex, int new_metric)
+route_table(const struct babel_route *route, unsigned char **pref_src_return)
 {
     struct filter_result filter_result;
-    unsigned char *pref_src = NULL;
-    unsigned int ifindex = route->neigh->ifp->ifindex;
-
     int m = install_filter(route->src->prefix, route->src->plen,
                            route->src->src_prefix, route->src->src_plen,
                            route->src->tos,
-                           ifindex, &filter_result);
-    if (m < INFINITY)
-        pref_src = filter_result.pref_src;
-
-    int table = filter_result.table ? filter_result.table : export_table;
-
-    return kernel_route(operation, table, route->src->prefix, route->src->plen,
-                        route->src->src_prefix, route->src->src_plen,
-                        route->src->tos, pref_src,
-                        route->nexthop, ifindex,
-                        metric, new_next_hop, new_ifindex, new_metric,
-                        operation == ROUTE_MODIFY ? table : 0);
+                           route->neigh->ifp->ifindex, &filter_result);
+    if(pref_src_return)
+        *pref_src_return = m < INFINITY ? filter_result.pref_src : NULL;
+
+    return filter_result.table ? filter_result.table : export_table;
+}
+
+void
+kernel_route_params(const struct babel_route *route,
+                    int *table_return, unsigned int *metric_return)
+{
+    *table_return = route_table(route, NULL);
+    *metric_return = metric_to_kernel(route_metric(route));
+}
+
+/* When the kernel worker is running, the change is only queued, and
+   0 is returned; failures are reported to change_route_failed. */
+static int
+change_route(int operation, const struct babel_route *route, int metric,
+             const unsigned char *new_next_hop,
+             int new_ifindex, int new_metric, unsigned int cookie)
+{
+    unsigned char *pref_src;
+    unsigned int ifindex = route->neigh->ifp->ifindex;
+    int table = route_table(route, &pref_src);
+
+    trace_stage(TRACE_SELECT, route->src->tos);
+    return kernel_route_async(operation, table,
+                              route->src->prefix, route->src->plen,
+                              route->src->src_prefix, route->src->src_plen,
+                              route->src->tos, pref_src,
+                              route->nexthop, ifindex,
+                              metric, new_next_hop, new_ifindex, new_metric,
+                              operation == ROUTE_MODIFY ? table : 0,
+                              change_route_failed, cookie);
+}
+
+/* Take over a route left in the kernel by a previous instance. */
+static int
+adopt_stale_route(struct babel_route *route, struct stale_route *stale)
+{
+    unsigned char *pref_src;
+    int table = route_table(route, &pref_src);
+    int rc;
+
+    debugf("Adopting stale route %s from %s.\n",
+           format_prefix(stale->prefix, stale->plen),
+           format_prefix(stale->src_prefix, stale->src_plen));
+    trace_stage(TRACE_SELECT, route->src->tos);
+    rc = kernel_route_async(ROUTE_MODIFY, stale->table,
+                            route->src->prefix, route->src->plen,
+                            route->src->src_prefix, route->src->src_plen,
+                            route->src->tos, pref_src,
+                            stale->nexthop, stale->ifindex, stale->metric,
+                            route->nexthop, route->neigh->ifp->ifindex,
+                            metric_to_kernel(route_metric(route)), table,
+                            change_route_failed, tag_route(route));
+    release_stale_route(stale);
+    return rc;
 }
 
 void
 install_route(struct babel_route *route)
 {
+    struct stale_route *stale;
     int i, rc;
 
     if(route->installed)
@@ -499,14 +648,21 @@ install_route(struct babel_route *route)
            format_prefix(route->src->prefix, route->src->plen),
            format_prefix(route->src->src_prefix, route->src->src_plen),
            format_tos_value(route->src->tos));
-    rc = change_route(ROUTE_ADD, route, metric_to_kernel(route_metric(route)),
-                      NULL, 0, 0);
+    stale = find_stale_route(route->src->prefix, route->src->plen,
+                             route->src->src_prefix, route->src->src_plen,
+                             route->src->tos);
+    if(stale)
+        rc = adopt_stale_route(route, stale);
+    else
+        rc = change_route(ROUTE_ADD, route,
+                          metric_to_kernel(route_metric(route)), NULL, 0, 0,
+                          tag_route(route));
     if(rc < 0 && errno != EEXIST) {
         perror("kernel_route(ADD)");
         return;
     }
 
-    route->installed = 1;
+    set_route_installed(route, 1);
     move_installed_route(route, i);
 
     local_notify_route(route, LOCAL_CHANGE);
@@ -520,14 +676,14 @@ uninstall_route(struct babel_route *route)
     if(!route->installed)
         return;
 
-    route->installed = 0;
+    set_route_installed(route, 0);
 
     debugf("uninstall_route(%s from %s) with TOS %s\n",
            format_prefix(route->src->prefix, route->src->plen),
            format_prefix(route->src->src_prefix, route->src->src_plen),
            format_tos_value(route->src->tos));
     rc = change_route(ROUTE_FLUSH, route, metric_to_kernel(route_metric(route)),
-                      NULL, 0, 0);
+                      NULL, 0, 0, 0);
     if(rc < 0) {
         perror("kernel_route(FLUSH)");
         return;
@@ -562,14 +718,14 @@ switch_routes(struct babel_route *old, struct babel_route *new)
            format_tos_value(old->src->tos));
     rc = change_route(ROUTE_MODIFY, old, metric_to_kernel(route_metric(old)),
                       new->nexthop, new->neigh->ifp->ifindex,
-                      metric_to_kernel(route_metric(new)));
+                      metric_to_kernel(route_metric(new)), tag_route(new));
     if(rc < 0) {
         perror("kernel_route(MODIFY)");
         return;
     }
 
-    old->installed = 0;
-    new->installed = 1;
+    set_route_installed(old, 0);
+    set_route_installed(new, 1);
     move_installed_route(new, find_route_slot(new->src->prefix, new->src->plen,
                                               new->src->src_prefix,
                                               new->src->src_plen,
@@ -594,7 +750,8 @@ change_route_metric(struct babel_route *route,
                old_metric, new_metric,
                format_tos_value(route->src->tos));
         rc = change_route(ROUTE_MODIFY, route, old_metric, route->nexthop,
-                          route->neigh->ifp->ifindex, new_metric);
+                          route->neigh->ifp->ifindex, new_metric,
+                          tag_route(route));
         if(rc < 0) {
             perror("kernel_route(MODIFY metric)");
             return;
@@ -40,6 +40,8 @@ struct babel_route {
     time_t smoothed_metric_time;
     short installed;
     short channels_len;
+    /* Tag of the last kernel change that installed this route. */
+    unsigned int kernel_seqno;
     unsigned char *channels;
     struct babel_route *next;
 };
@@ -49,6 +51,8 @@ struct route_stream;
 extern struct babel_route **routes;
 extern int kernel_metric, allow_duplicates, reflect_kernel_metric;
 extern int diversity_kind, diversity_factor;
+/* Incremented whenever a route is installed, uninstalled or freed, or
+   an xroute is added or removed.  Allows caching pointers to routes. */
 
 static inline int
 route_metric(const struct babel_route *route)
@@ -78,11 +82,20 @@ struct babel_route *find_installed_route(const unsigned char *prefix,
 int installed_routes_estimate(void);
 void flush_route(struct babel_route *route);
 void flush_all_routes(void);
+void forget_installed_routes(void);
 void flush_neighbour_routes(struct neighbour *neigh);
 void flush_interface_routes(struct interface *ifp, int v4only);
 struct route_stream *route_stream(int which);
+struct route_stream *route_stream_from(int installed,
+                                      const unsigned char *prefix,
+                                      unsigned char plen,
+                                      const unsigned char *src_prefix,
+                                      unsigned char src_plen,
+                                      const unsigned char *tos);
 struct babel_route *route_stream_next(struct route_stream *stream);
 void route_stream_done(struct route_stream *stream);
+void kernel_route_params(const struct babel_route *route,
+                         int *table_return, unsigned int *metric_return);
 void install_route(struct babel_route *route);
 void uninstall_route(struct babel_route *route);
 int route_feasible(struct babel_route *route);
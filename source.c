@@ -24,6 +24,9 @@ THE SOFTWARE.
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
 #include <sys/time.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -38,6 +41,10 @@ THE SOFTWARE.
 static struct source **sources = NULL;
 static int source_slots = 0, max_source_slots = 0;
 
+char *source_file = NULL;
+/* Whether the table changed since the last checkpoint. */
+static int sources_dirty = 0;
+
 static int
 source_compare(const unsigned char *id,
                const unsigned char *prefix, unsigned char plen,
@@ -175,6 +182,7 @@ find_source(const unsigned char *id,
                 (source_slots - n) * sizeof(struct source*));
     source_slots++;
     sources[n] = src;
+    sources_dirty = 1;
 
     return src;
 }
@@ -210,8 +218,13 @@ update_source(struct source *src,
        (src->seqno == seqno && src->metric > metric)) {
         src->seqno = seqno;
         src->metric = metric;
+        sources_dirty = 1;
+    }
+    /* The age is part of the checkpoint, so refreshing it counts. */
+    if(src->time != now.tv_sec) {
+        src->time = now.tv_sec;
+        sources_dirty = 1;
     }
-    src->time = now.tv_sec;
 }
 
 void
@@ -228,6 +241,7 @@ expire_sources()
         if(src->route_count == 0 && src->time < now.tv_sec - SOURCE_GC_TIME) {
             free(src);
             sources[i] = NULL;
+            sources_dirty = 1;
             i++;
         } else {
             if(j < i) {
@@ -257,3 +271,177 @@ check_sources_released(void)
                     (int)src->route_count);
     }
 }
+
+/* Sources are saved with their age rather than their timestamp, since
+   our clock is monotonic and doesn't survive a reboot.  The caller saves
+   the wall-clock time alongside, and passes the time elapsed since then
+   to load_sources.  Expired sources are not saved, and restored sources
+   expire at the same time as they would have if we hadn't been
+   restarted. */
+
+#define SOURCE_RECORD_LEN 52
+
+int
+dump_sources(FILE *out)
+{
+    unsigned char buf[SOURCE_RECORD_LEN];
+    int i, count = 0;
+
+    for(i = 0; i < source_slots; i++) {
+        struct source *src = sources[i];
+        unsigned int age;
+
+        if(src->time < now.tv_sec - SOURCE_GC_TIME)
+            continue;
+        age = src->time < now.tv_sec ? now.tv_sec - src->time : 0;
+
+        memcpy(buf, src->id, 8);
+        memcpy(buf + 8, src->prefix, 16);
+        buf[24] = src->plen;
+        memcpy(buf + 25, src->src_prefix, 16);
+        buf[41] = src->src_plen;
+        buf[42] = src->tos[0];
+        buf[43] = 0;
+        DO_HTONS(buf + 44, src->seqno);
+        DO_HTONS(buf + 46, src->metric);
+        DO_HTONL(buf + 48, age);
+        if(fwrite(buf, SOURCE_RECORD_LEN, 1, out) != 1)
+            return -1;
+        count++;
+    }
+    return count;
+}
+
+int
+load_sources(FILE *in, int count, unsigned int elapsed)
+{
+    unsigned char buf[SOURCE_RECORD_LEN];
+    int i, loaded = 0;
+
+    for(i = 0; i < count; i++) {
+        struct source *src;
+        unsigned short seqno, metric;
+        unsigned int age;
+
+        if(fread(buf, SOURCE_RECORD_LEN, 1, in) != 1)
+            return -1;
+        DO_NTOHS(seqno, buf + 44);
+        DO_NTOHS(metric, buf + 46);
+        DO_NTOHL(age, buf + 48);
+        if(buf[24] > 128 || buf[41] > 128 ||
+           age > SOURCE_GC_TIME || elapsed > SOURCE_GC_TIME - age)
+            continue;
+        age += elapsed;
+
+        src = find_source(buf, buf + 8, buf[24], buf + 25, buf[41], buf + 42,
+                          1, seqno);
+        if(src == NULL)
+            return -1;
+        /* Don't override anything we've learnt since we started. */
+        if(src->metric < INFINITY)
+            continue;
+        src->seqno = seqno;
+        src->metric = metric;
+        src->time = now.tv_sec - age;
+        loaded++;
+    }
+    return loaded;
+}
+
+#define SOURCE_FILE_MAGIC "BABELSR1"
+
+/* Save the source table to source_file, so that a restarted node doesn't
+   accept every update and announce its own routes with stale seqnos.
+   Unless force is set, nothing is written if nothing changed. */
+int
+checkpoint_sources(int force)
+{
+    unsigned char header[16];
+    char tmp[1024];
+    FILE *out;
+    int count, rc;
+
+    if(source_file == NULL || (!force && !sources_dirty))
+        return 0;
+
+    rc = snprintf(tmp, sizeof(tmp), "%s.tmp", source_file);
+    if(rc < 0 || rc >= sizeof(tmp)) {
+        fprintf(stderr, "Source file name too long.\n");
+        return -1;
+    }
+
+    out = fopen(tmp, "w");
+    if(out == NULL) {
+        perror("open(source-file)");
+        return -1;
+    }
+
+    memset(header, 0, sizeof(header));
+    if(fwrite(header, sizeof(header), 1, out) != 1)
+        goto fail;
+    count = dump_sources(out);
+    if(count < 0)
+        goto fail;
+    memcpy(header, SOURCE_FILE_MAGIC, 8);
+    DO_HTONL(header + 8, count);
+    DO_HTONL(header + 12, (unsigned int)time(NULL));
+    if(fseek(out, 0, SEEK_SET) < 0 ||
+       fwrite(header, sizeof(header), 1, out) != 1 ||
+       fflush(out) != 0)
+        goto fail;
+    fsync(fileno(out));
+    fclose(out);
+
+    rc = rename(tmp, source_file);
+    if(rc < 0) {
+        perror("rename(source-file)");
+        unlink(tmp);
+        return -1;
+    }
+    sources_dirty = 0;
+    return count;
+
+ fail:
+    perror("write(source-file)");
+    fclose(out);
+    unlink(tmp);
+    return -1;
+}
+
+int
+restore_sources(void)
+{
+    unsigned char header[16];
+    unsigned int count, saved, wall;
+    FILE *in;
+    int rc;
+
+    if(source_file == NULL)
+        return 0;
+
+    in = fopen(source_file, "r");
+    if(in == NULL) {
+        if(errno == ENOENT)
+            return 0;
+        perror("open(source-file)");
+        return -1;
+    }
+
+    if(fread(header, sizeof(header), 1, in) != 1 ||
+       memcmp(header, SOURCE_FILE_MAGIC, 8) != 0) {
+        fprintf(stderr, "Couldn't parse source file.\n");
+        fclose(in);
+        return -1;
+    }
+    DO_NTOHL(count, header + 8);
+    DO_NTOHL(saved, header + 12);
+    wall = time(NULL);
+
+    rc = load_sources(in, count, wall > saved ? wall - saved : 0);
+    fclose(in);
+    if(rc < 0) {
+        fprintf(stderr, "Truncated source file.\n");
+        return -1;
+    }
+    return rc;
+}
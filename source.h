@@ -23,6 +23,8 @@ THE SOFTWARE.
 */
 
 #define SOURCE_GC_TIME 200
+/* How often the source table is saved to source_file, in seconds. */
+#define SOURCE_CHECKPOINT_TIME 60
 
 struct source {
     unsigned char id[8];
@@ -37,6 +39,8 @@ struct source {
     time_t time;
 };
 
+extern char *source_file;
+
 struct source *find_source(const unsigned char *id,
                            const unsigned char *prefix,
                            unsigned char plen,
@@ -50,3 +54,7 @@ void update_source(struct source *src,
                    unsigned short seqno, unsigned short metric);
 void expire_sources(void);
 void check_sources_released(void);
+int dump_sources(FILE *out);
+int load_sources(FILE *in, int count, unsigned int elapsed);
+int checkpoint_sources(int force);
+int restore_sources(void);
@@ -0,0 +1,204 @@
+/*
+Copyright (c) 2007, 2008 by Juliusz Chroboczek
+Copyright (c) 2021 by Florian Wiedner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "babeld.h"
+#include "util.h"
+#include "timer.h"
+
+static struct timer *timers = NULL;
+static int num_timers = 0, max_timers = 0;
+/* Size of the heap after the last compaction. */
+static int compacted_timers = 0;
+/* Timers scheduled while dispatching wait for the next round. */
+static unsigned int timer_round = 0;
+
+static int
+timer_valid(const struct timer *timer)
+{
+    return timer->timeout != NULL &&
+        timer->timeout->tv_sec == timer->time.tv_sec &&
+        timer->timeout->tv_usec == timer->time.tv_usec;
+}
+
+static int
+timer_before(int i, int j)
+{
+    return timeval_compare(&timers[i].time, &timers[j].time) < 0;
+}
+
+static void
+timer_swap(int i, int j)
+{
+    struct timer t = timers[i];
+    timers[i] = timers[j];
+    timers[j] = t;
+}
+
+static void
+timer_up(int i)
+{
+    while(i > 0) {
+        int parent = (i - 1) / 2;
+        if(!timer_before(i, parent))
+            break;
+        timer_swap(i, parent);
+        i = parent;
+    }
+}
+
+static void
+timer_down(int i)
+{
+    while(1) {
+        int l = 2 * i + 1, r = l + 1, m = i;
+        if(l < num_timers && timer_before(l, m))
+            m = l;
+        if(r < num_timers && timer_before(r, m))
+            m = r;
+        if(m == i)
+            break;
+        timer_swap(i, m);
+        i = m;
+    }
+}
+
+static void
+timer_pop_top(void)
+{
+    num_timers--;
+    if(num_timers > 0) {
+        timers[0] = timers[num_timers];
+        timer_down(0);
+    }
+}
+
+/* Drop stale entries and rebuild the heap. */
+static void
+compact_timers(void)
+{
+    int i, j = 0;
+
+    for(i = 0; i < num_timers; i++) {
+        if(timer_valid(&timers[i]))
+            timers[j++] = timers[i];
+    }
+    num_timers = j;
+    for(i = num_timers / 2 - 1; i >= 0; i--)
+        timer_down(i);
+    compacted_timers = num_timers;
+}
+
+void
+schedule_timer(const struct timeval *timeout, int type, void *owner)
+{
+    if(timeout->tv_sec == 0 || type == 0)
+        return;
+
+    /* Entries go stale every time a deadline is moved, don't let them
+       pile up. */
+    if(num_timers >= 64 && num_timers >= 4 * compacted_timers)
+        compact_timers();
+
+    if(num_timers >= max_timers) {
+        int n = max_timers < 1 ? 64 : 2 * max_timers;
+        struct timer *new_timers = realloc(timers, n * sizeof(struct timer));
+        if(new_timers == NULL) {
+            perror("realloc(timers)");
+            return;
+        }
+        timers = new_timers;
+        max_timers = n;
+    }
+
+    timers[num_timers].time = *timeout;
+    timers[num_timers].timeout = timeout;
+    timers[num_timers].type = type;
+    timers[num_timers].owner = owner;
+    timers[num_timers].round = timer_round;
+    num_timers++;
+    timer_up(num_timers - 1);
+}
+
+/* Called before the owner is freed, since the entries point into it. */
+void
+cancel_timers(void *owner)
+{
+    int i;
+
+    for(i = 0; i < num_timers; i++) {
+        if(timers[i].owner == owner)
+            timers[i].timeout = NULL;
+    }
+}
+
+/* Returns the earliest pending deadline, or NULL if there is none. */
+const struct timeval *
+next_timer(void)
+{
+    while(num_timers > 0 && !timer_valid(&timers[0]))
+        timer_pop_top();
+    return num_timers > 0 ? &timers[0].time : NULL;
+}
+
+void
+start_timers(void)
+{
+    timer_round++;
+}
+
+/* Pops the earliest timer if it is due and was scheduled before the
+   last call to start_timers, so that a handler rescheduling itself
+   with no delay cannot starve the sockets. */
+int
+pop_timer(struct timer *timer_return)
+{
+    const struct timeval *next = next_timer();
+
+    if(next == NULL || timeval_compare(next, &now) > 0 ||
+       timers[0].round == timer_round)
+        return 0;
+
+    *timer_return = timers[0];
+    timer_pop_top();
+
+    /* A deadline that was moved away and back leaves a duplicate. */
+    while(num_timers > 0 && timers[0].timeout == timer_return->timeout &&
+          timers[0].type == timer_return->type &&
+          timeval_compare(&timers[0].time, &timer_return->time) == 0)
+        timer_pop_top();
+
+    return 1;
+}
+
+void
+flush_timers(void)
+{
+    free(timers);
+    timers = NULL;
+    num_timers = max_timers = compacted_timers = 0;
+}
@@ -0,0 +1,50 @@
+/*
+Copyright (c) 2007, 2008 by Juliusz Chroboczek
+Copyright (c) 2021 by Florian Wiedner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* Per-object deadlines are kept in a binary heap.  Each entry points at
+   the struct timeval owned by the subsystem, and is only valid as long
+   as that deadline hasn't changed; stale entries are dropped when they
+   reach the top of the heap. */
+
+#define TIMER_HELLO 1
+#define TIMER_UPDATE 2
+#define TIMER_UPDATE_SLICE 3
+#define TIMER_UPDATE_FLUSH 4
+#define TIMER_PACING 5
+#define TIMER_INTERFACE_BUF 6
+#define TIMER_NEIGHBOUR_BUF 7
+
+struct timer {
+    struct timeval time;
+    const struct timeval *timeout;
+    int type;
+    void *owner;
+    unsigned int round;
+};
+
+void schedule_timer(const struct timeval *timeout, int type, void *owner);
+void cancel_timers(void *owner);
+const struct timeval *next_timer(void);
+void start_timers(void);
+int pop_timer(struct timer *timer_return);
+void flush_timers(void);
@@ -0,0 +1,121 @@
+/*
+Copyright (c) 2007, 2008 by Juliusz Chroboczek
+Copyright (c) 2021 by Florian Wiedner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "babeld.h"
+#include "trace.h"
+
+static const char *stage_names[TRACE_STAGES] = {
+    "update", "select", "kernel", "sent"
+};
+
+struct trace_histogram {
+    unsigned long count;
+    unsigned long long sum;
+    unsigned long long max;
+    unsigned int buckets[TRACE_BUCKETS];
+};
+
+/* Indexed by DSCP value, allocated when the class is first seen. */
+static struct trace_histogram *histograms[256];
+
+unsigned long long trace_receive_time = 0;
+unsigned long long trace_start = 0;
+unsigned char trace_tos = 0;
+
+/* This is called from the kernel worker too, so it mustn't touch any
+   global state. */
+unsigned long long
+trace_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void
+trace_record(int stage, unsigned char tos, unsigned long long start,
+             unsigned long long end)
+{
+    struct trace_histogram *h;
+    unsigned long long us = end > start ? end - start : 0;
+    int i = 0;
+
+    if(start == 0)
+        return;
+
+    if(histograms[tos] == NULL) {
+        histograms[tos] =
+            calloc(TRACE_STAGES, sizeof(struct trace_histogram));
+        if(histograms[tos] == NULL)
+            return;
+    }
+    h = &histograms[tos][stage];
+
+    while(i < TRACE_BUCKETS - 1 && (us >> (i + 1)) != 0)
+        i++;
+    h->buckets[i]++;
+    h->count++;
+    h->sum += us;
+    h->max = MAX(h->max, us);
+}
+
+/* Formats one histogram for the local interface.  Returns 0 if there's
+   nothing to report, and -1 if the buffer is too small. */
+int
+trace_format(int stage, unsigned char tos, char *buf, int size)
+{
+    struct trace_histogram *h;
+    int i, n, last, rc;
+
+    if(histograms[tos] == NULL || histograms[tos][stage].count == 0)
+        return 0;
+    h = &histograms[tos][stage];
+
+    rc = snprintf(buf, size,
+                  "stats latency %s tos %02x count %lu mean-us %llu "
+                  "max-us %llu buckets ",
+                  stage_names[stage], tos, h->count, h->sum / h->count,
+                  h->max);
+    if(rc < 0 || rc >= size)
+        return -1;
+    n = rc;
+
+    last = TRACE_BUCKETS - 1;
+    while(last > 0 && h->buckets[last] == 0)
+        last--;
+    for(i = 0; i <= last; i++) {
+        rc = snprintf(buf + n, size - n, i < last ? "%u," : "%u\n",
+                      h->buckets[i]);
+        if(rc < 0 || rc >= size - n)
+            return -1;
+        n += rc;
+    }
+    return n;
+}
@@ -0,0 +1,70 @@
+/*
+Copyright (c) 2007, 2008 by Juliusz Chroboczek
+Copyright (c) 2021 by Florian Wiedner
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* Convergence latency.  When an update is parsed, the time at which the
+   packet carrying it was received is made current; the route changes
+   and kernel requests that it triggers are timestamped against it, and
+   the latencies are accumulated into per-stage, per-DSCP histograms. */
+
+#define TRACE_UPDATE 0          /* update handed to update_route */
+#define TRACE_SELECT 1          /* route selection changed the kernel */
+#define TRACE_KERNEL 2          /* kernel acknowledged the change */
+#define TRACE_SENT 3            /* triggered update sent */
+#define TRACE_STAGES 4
+
+/* Bucket i counts latencies from 2^i (0 for the first bucket) to
+   2^(i+1) microseconds, the last one everything above. */
+#define TRACE_BUCKETS 24
+
+/* Receive time of the last batch of packets, in microseconds. */
+extern unsigned long long trace_receive_time;
+/* Receive time of the update being processed, 0 if none. */
+extern unsigned long long trace_start;
+extern unsigned char trace_tos;
+
+unsigned long long trace_now(void);
+void trace_record(int stage, unsigned char tos, unsigned long long start,
+                  unsigned long long end);
+int trace_format(int stage, unsigned char tos, char *buf, int size);
+
+static inline void
+trace_begin(const unsigned char *tos)
+{
+    trace_start = trace_receive_time;
+    trace_tos = tos[0];
+    trace_record(TRACE_UPDATE, trace_tos, trace_start, trace_now());
+}
+
+static inline void
+trace_end(void)
+{
+    trace_start = 0;
+}
+
+/* Record a stage of the update being processed, if any. */
+static inline void
+trace_stage(int stage, const unsigned char *tos)
+{
+    if(trace_start != 0)
+        trace_record(stage, tos[0], trace_start, trace_now());
+}
@@ -286,11 +286,13 @@ const unsigned char v4prefix[16] =
 static const unsigned char llprefix[16] =
     {0xFE, 0x80};
 
+/* The kernel worker formats routes for debugging, so the buffers of the
+   functions that it uses are per-thread. */
 const char *
 format_address(const unsigned char *address)
 {
-    static char buf[4][INET6_ADDRSTRLEN];
-    static int i = 0;
+    static _Thread_local char buf[4][INET6_ADDRSTRLEN];
+    static _Thread_local int i = 0;
     i = (i + 1) % 4;
     if(v4mapped(address))
         inet_ntop(AF_INET, address + 12, buf[i], INET6_ADDRSTRLEN);
@@ -302,8 +304,8 @@ format_address(const unsigned char *address)
 const char *
 format_prefix(const unsigned char *prefix, unsigned char plen)
 {
-    static char buf[4][INET6_ADDRSTRLEN + 4];
-    static int i = 0;
+    static _Thread_local char buf[4][INET6_ADDRSTRLEN + 4];
+    static _Thread_local int i = 0;
     int n;
     i = (i + 1) % 4;
     if(plen >= 96 && v4mapped(prefix)) {
@@ -321,7 +323,7 @@ format_prefix(const unsigned char *prefix, unsigned char plen)
 const char *
 format_tos_value(const unsigned char *tos)
 {
-    static char buf[3];
+    static _Thread_local char buf[3];
     snprintf(buf, sizeof(char)*3, "%02x",tos[0]);
     return buf;
 }
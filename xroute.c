@@ -41,6 +41,7 @@ THE SOFTWARE.
 #include "util.h"
 #include "configuration.h"
 #include "local.h"
+#include "lookup.h"
 
 static struct xroute *xroutes;
 static int numxroutes = 0, maxxroutes = 0;
@@ -136,12 +137,17 @@ add_xroute(unsigned char prefix[16], unsigned char plen,
     if(i >= 0)
         return -1;
 
+    if(add_lookup_entry(prefix, plen, src_prefix, src_plen, tos, NULL) < 0)
+        return -1;
+
     if(numxroutes >= maxxroutes) {
         struct xroute *new_xroutes;
         int num = maxxroutes < 1 ? 8 : 2 * maxxroutes;
         new_xroutes = realloc(xroutes, num * sizeof(struct xroute));
-        if(new_xroutes == NULL)
+        if(new_xroutes == NULL) {
+            flush_lookup_entry(prefix, plen, src_prefix, src_plen, tos, NULL);
             return -1;
+        }
         maxxroutes = num;
         xroutes = new_xroutes;
     }
@@ -159,6 +165,7 @@ add_xroute(unsigned char prefix[16], unsigned char plen,
     xroutes[n].metric = metric;
     xroutes[n].ifindex = ifindex;
     xroutes[n].proto = proto;
+    invalidate_buffered_update(prefix, plen, src_prefix, src_plen, tos);
     local_notify_xroute(&xroutes[n], LOCAL_ADD);
     return 1;
 }
@@ -172,6 +179,11 @@ flush_xroute(struct xroute *xroute)
     assert(i >= 0 && i < numxroutes);
 
     local_notify_xroute(xroute, LOCAL_FLUSH);
+    flush_lookup_entry(xroute->prefix, xroute->plen,
+                       xroute->src_prefix, xroute->src_plen, xroute->tos, NULL);
+    invalidate_buffered_update(xroute->prefix, xroute->plen,
+                               xroute->src_prefix, xroute->src_plen,
+                               xroute->tos);
 
     if(i != numxroutes - 1)
         memmove(xroutes + i, xroutes + i + 1,
@@ -353,13 +365,48 @@ kernel_route_compare(const void *v1, const void *v2)
     return 0;
 }
 
+/* Find the summary for a given aggregate among the n summaries stored at
+   aggregates, or add it if there's room. */
+static int
+find_aggregate(struct kernel_route *aggregates, int *n, int max,
+               const unsigned char *prefix, unsigned char plen,
+               const struct kernel_route *route)
+{
+    int i;
+
+    for(i = 0; i < *n; i++) {
+        if(aggregates[i].plen == plen &&
+           memcmp(aggregates[i].prefix, prefix, 16) == 0 &&
+           aggregates[i].src_plen == route->src_plen &&
+           memcmp(aggregates[i].src_prefix, route->src_prefix, 16) == 0 &&
+           memcmp(aggregates[i].tos, route->tos, 1) == 0)
+            return i;
+    }
+
+    if(*n >= max)
+        return -1;
+
+    memset(&aggregates[i], 0, sizeof(struct kernel_route));
+    normalize_prefix(aggregates[i].prefix, prefix, plen);
+    aggregates[i].plen = plen;
+    memcpy(aggregates[i].src_prefix, route->src_prefix, 16);
+    aggregates[i].src_plen = route->src_plen;
+    memcpy(aggregates[i].tos, route->tos, 1);
+    aggregates[i].metric = route->metric;
+    aggregates[i].proto = RTPROT_BABEL_AGGREGATE;
+    (*n)++;
+    return i;
+}
+
 int
 check_xroutes(int send_updates)
 {
     int i, j, change = 0, rc;
     struct kernel_route *routes;
     struct filter_result filter_result;
-    int numroutes;
+    int numroutes, numaggregates;
+    /* For each route, the summary that may suppress it, or -1. */
+    int *suppressed = NULL;
     static int maxroutes = 8;
     const int maxmaxroutes = 256 * 1024;
 
@@ -390,7 +437,16 @@ check_xroutes(int send_updates)
     if(numroutes >= maxroutes)
         goto resize;
 
+    suppressed = malloc(numroutes * sizeof(int));
+    if(numroutes > 0 && suppressed == NULL) {
+        free(routes);
+        return -1;
+    }
+
+    /* Summaries are stored in the free space after the kernel routes. */
+    numaggregates = 0;
     for(i = 0; i < numroutes; i++) {
+        suppressed[i] = -1;
         routes[i].metric = redistribute_filter(routes[i].prefix, routes[i].plen,
                                                routes[i].src_prefix,
                                                routes[i].src_plen,
@@ -405,9 +461,61 @@ check_xroutes(int send_updates)
         if(filter_result.tos != NULL) {
             memcpy(routes[i].tos, filter_result.tos, 1);
         }
+        if(filter_result.aggregate != NULL &&
+           routes[i].metric < INFINITY &&
+           routes[i].plen > filter_result.aggregate_plen &&
+           in_prefix(routes[i].prefix, filter_result.aggregate,
+                     filter_result.aggregate_plen)) {
+            struct kernel_route *aggregate;
+            rc = find_aggregate(routes + numroutes, &numaggregates,
+                                maxroutes - numroutes,
+                                filter_result.aggregate,
+                                filter_result.aggregate_plen,
+                                &routes[i]);
+            if(rc < 0)
+                goto resize;
+            aggregate = &routes[numroutes + rc];
+            aggregate->metric = MIN(aggregate->metric, routes[i].metric);
+            if(filter_result.summary_only)
+                suppressed[i] = rc;
+        }
+    }
+
+    /* Only more-specifics with the same metric as their summary are
+       suppressed, others are still announced on their own. */
+    for(i = 0; i < numroutes; i++) {
+        if(suppressed[i] >= 0 &&
+           routes[numroutes + suppressed[i]].metric == routes[i].metric)
+            routes[i].metric = INFINITY;
     }
+    free(suppressed);
+    suppressed = NULL;
+    numroutes += numaggregates;
 
     qsort(routes, numroutes, sizeof(struct kernel_route), kernel_route_compare);
+
+    /* A prefix may be both in the kernel and a summary, or in the kernel
+       more than once.  Keep the route with the lowest metric, preferring
+       a kernel route to a summary, and then the lowest ifindex, so that
+       the choice doesn't depend on the order of the dump. */
+    j = 0;
+    for(i = 0; i < numroutes; i++) {
+        if(j > 0 && kernel_route_compare(&routes[j - 1], &routes[i]) == 0) {
+            struct kernel_route *kept = &routes[j - 1];
+            int kept_aggregate = kept->proto == RTPROT_BABEL_AGGREGATE;
+            int aggregate = routes[i].proto == RTPROT_BABEL_AGGREGATE;
+            if(routes[i].metric < kept->metric ||
+               (routes[i].metric == kept->metric &&
+                (aggregate < kept_aggregate ||
+                 (aggregate == kept_aggregate &&
+                  routes[i].ifindex < kept->ifindex))))
+                *kept = routes[i];
+        } else {
+            routes[j++] = routes[i];
+        }
+    }
+    numroutes = j;
+
     i = 0;
     j = 0;
     while(i < numroutes || j < numxroutes) {
@@ -460,11 +568,11 @@ check_xroutes(int send_updates)
             unsigned char src_prefix[16], src_plen;
             unsigned char tos[1];
             struct babel_route *route;
-            memcpy(prefix, xroutes[i].prefix, 16);
-            plen = xroutes[i].plen;
-            memcpy(src_prefix, xroutes[i].src_prefix, 16);
-            src_plen = xroutes[i].src_plen;
-            memcpy(tos, xroutes[i].tos, 1);
+            memcpy(prefix, xroutes[j].prefix, 16);
+            plen = xroutes[j].plen;
+            memcpy(src_prefix, xroutes[j].src_prefix, 16);
+            src_plen = xroutes[j].src_plen;
+            memcpy(tos, xroutes[j].tos, 1);
             flush_xroute(&xroutes[j]);
             route = find_best_route(prefix, plen, src_prefix, src_plen,
                                     tos,
@@ -480,6 +588,10 @@ check_xroutes(int send_updates)
                routes[i].proto != xroutes[j].proto) {
                 xroutes[j].metric = routes[i].metric;
                 xroutes[j].proto = routes[i].proto;
+                invalidate_buffered_update(xroutes[j].prefix, xroutes[j].plen,
+                                           xroutes[j].src_prefix,
+                                           xroutes[j].src_plen,
+                                           xroutes[j].tos);
                 local_notify_xroute(&xroutes[j], LOCAL_CHANGE);
                 if(send_updates)
                     send_update(NULL, 0, xroutes[j].prefix, xroutes[j].plen,
@@ -496,6 +608,8 @@ check_xroutes(int send_updates)
     return change;
 
  resize:
+    free(suppressed);
+    suppressed = NULL;
     free(routes);
     if(maxroutes >= maxmaxroutes)
         return -1;